@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "batch.h"
+#include "render.h"
+
+namespace {
+
+BatchOutcome run_job(const BatchJob& job, SeedCache& seeds)
+{
+    BatchOutcome outcome;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        const RenderConfig& config = job.config;
+        if (strip_height(config) < image_height(config)) {
+            render(config);
+            outcome.outputs.push_back(config.output);
+        } else {
+            RenderControl control;
+            control.priority = job.priority;
+            RenderResult result = render_result(config, &control, &seeds);
+            for (const Image& image : result.images) {
+                write_ppm(image);
+                outcome.outputs.push_back(image.output);
+            }
+        }
+    } catch (const std::exception& e) {
+        outcome.error = e.what();
+    }
+    outcome.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return outcome;
+}
+
+}
+
+void render_batch(const std::vector<BatchJob>& jobs, std::size_t max_in_flight, const std::function<void(std::size_t job, const BatchOutcome& outcome)>& report)
+{
+    std::vector<std::size_t> order(jobs.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto rank = [&](std::size_t j) {
+        const RenderConfig& c = jobs[j].config;
+        return std::make_tuple(-jobs[j].priority, c.size, c.seed_max_iter, c.n_dilations, c.formula, !c.replay_seeds.empty());
+    };
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return rank(a) < rank(b); });
+
+    SeedCache seeds;
+    std::counting_semaphore<> slots(std::max<std::size_t>(1, max_in_flight));
+    std::mutex report_mutex;
+
+    std::vector<std::thread> drivers;
+    for (std::size_t j : order) {
+        slots.acquire();
+        drivers.emplace_back([&, j] {
+            BatchOutcome outcome = run_job(jobs[j], seeds);
+            {
+                std::lock_guard lock(report_mutex);
+                report(j, outcome);
+            }
+            slots.release();
+        });
+    }
+    for (auto& driver : drivers) {
+        driver.join();
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "render.h"
+
+struct BatchJob {
+    RenderConfig config;
+    int priority = 0;
+};
+
+// Images a job wrote and how long it took from seed pass to written files,
+// or why it failed.
+struct BatchOutcome {
+    std::vector<std::string> outputs;
+    double seconds = 0.0;
+    std::string error;
+};
+
+// Renders all jobs with their sampling streams scheduled on the default
+// pool. Jobs start in order of priority, highest first, with
+// jobs that share seed mask parameters next to each other so they share one
+// seed pass. Up to max_in_flight jobs run at a time, which lets one job's
+// images be tone mapped and written while the next one samples, and lets a
+// lower priority job fill the cores a finishing job leaves idle. report is
+// called once per job as it finishes, never concurrently.
+void render_batch(const std::vector<BatchJob>& jobs, std::size_t max_in_flight, const std::function<void(std::size_t job, const BatchOutcome& outcome)>& report);
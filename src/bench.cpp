@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "frames.h"
+#include "image.h"
+#include "render.h"
+
+std::uint64_t peak_rss_kb()
+{
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            std::istringstream iss(line.substr(6));
+            std::uint64_t kb = 0;
+            iss >> kb;
+            return kb;
+        }
+    }
+
+    return 0;
+}
+
+void reset_peak_rss()
+{
+    // Writing 5 to clear_refs resets VmHWM to the current RSS (Linux >= 4.0).
+    std::ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+}
+
+double cpu_seconds()
+{
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    auto seconds = [](const timeval& tv) { return tv.tv_sec + tv.tv_usec * 1e-6; };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+namespace {
+
+struct ScalingResult {
+    std::uint64_t size;
+    std::uint64_t max_iter;
+    std::size_t n_threads;
+    RenderStats stats;
+    std::uint64_t peak_rss_kb;
+    double efficiency;
+
+    double throughput() const { return stats.n_samples / stats.sample_seconds; }
+};
+
+}
+
+void bench_scaling(const ScalingBenchConfig& config)
+{
+    std::vector<ScalingResult> results;
+
+    for (std::uint64_t size : config.sizes) {
+        auto good_points = find_good_points(size, config.render.seed_max_iter, config.render.n_dilations, false, parse_formula(config.render.formula));
+
+        for (std::uint64_t max_iter : config.max_iters) {
+            for (std::size_t n_threads : config.threads) {
+                RenderConfig render = config.render;
+                render.size = size;
+                render.max_iter = max_iter;
+                render.n_threads = n_threads;
+                render.points_per_thread = config.weak ? config.points : config.points / n_threads;
+                render.quiet = true;
+
+                std::cout << "size=" << size << " max_iter=" << max_iter << " threads=" << n_threads << " ... ";
+                std::cout.flush();
+
+                // Each sweep point gets a pool of its own size, so the
+                // streams and the merge run on n_threads workers.
+                TaskPool pool(n_threads, render.pin_workers);
+                RenderControl control;
+                control.pool = &pool;
+
+                reset_peak_rss();
+                RenderStats stats;
+                sample_buddhabrot(render, good_points, stats, nullptr, {}, &control);
+
+                results.push_back({ size, max_iter, n_threads, stats, peak_rss_kb(), 1.0 });
+                std::cout << std::fixed << std::setprecision(3) << stats.sample_seconds << "s\n";
+            }
+        }
+    }
+
+    // Efficiency is per-thread throughput relative to the smallest thread
+    // count measured for the same size and max_iter, which covers both the
+    // strong (fixed total work) and weak (fixed work per thread) cases.
+    std::map<std::pair<std::uint64_t, std::uint64_t>, const ScalingResult*> baselines;
+    for (const auto& result : results) {
+        auto& base = baselines[{ result.size, result.max_iter }];
+        if (!base || result.n_threads < base->n_threads) {
+            base = &result;
+        }
+    }
+    for (auto& result : results) {
+        const ScalingResult* base = baselines[{ result.size, result.max_iter }];
+        result.efficiency = (result.throughput() / result.n_threads) / (base->throughput() / base->n_threads);
+    }
+
+    std::ofstream csv(config.csv);
+    csv << "mode,size,max_iter,threads,samples,sample_seconds,samples_per_second,efficiency,peak_rss_kb,merge_seconds\n";
+    for (const auto& result : results) {
+        csv << (config.weak ? "weak" : "strong") << ","
+            << result.size << ","
+            << result.max_iter << ","
+            << result.n_threads << ","
+            << result.stats.n_samples << ","
+            << result.stats.sample_seconds << ","
+            << result.throughput() << ","
+            << result.efficiency << ","
+            << result.peak_rss_kb << ","
+            << result.stats.merge_seconds << "\n";
+    }
+
+    std::cout << "\n" << (config.weak ? "Weak" : "Strong") << " scaling summary (" << config.csv << ")\n";
+    std::cout << std::setfill(' ') << std::setw(8) << "size" << std::setw(10) << "max_iter" << std::setw(9) << "threads"
+              << std::setw(14) << "Msamples/s" << std::setw(8) << "eff" << std::setw(12) << "rss MB"
+              << std::setw(11) << "merge s" << "\n";
+    for (const auto& result : results) {
+        std::cout << std::setw(8) << result.size << std::setw(10) << result.max_iter << std::setw(9) << result.n_threads
+                  << std::setw(14) << std::setprecision(2) << result.throughput() / 1e6
+                  << std::setw(8) << std::setprecision(2) << result.efficiency
+                  << std::setw(12) << std::setprecision(1) << result.peak_rss_kb / 1024.0
+                  << std::setw(11) << std::setprecision(3) << result.stats.merge_seconds << "\n";
+    }
+}
+
+namespace {
+
+std::vector<float> normalized_log_image(const std::vector<std::uint64_t>& counts)
+{
+    std::vector<float> image = log_image(counts);
+    auto [vmin, vmax] = std::minmax_element(image.begin(), image.end());
+    float lo = *vmin;
+    float range = std::max(*vmax - lo, 1e-6f);
+    std::transform(image.begin(), image.end(), image.begin(), [&](float v) { return (v - lo) / range; });
+
+    return image;
+}
+
+double rmse(const std::vector<float>& a, const std::vector<float>& b)
+{
+    double sum = 0.0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        double d = a[i] - b[i];
+        sum += d * d;
+    }
+
+    return std::sqrt(sum / a.size());
+}
+
+// Mean SSIM over 8x8 windows with a stride of 4, for images in [0, 1].
+double ssim(const std::vector<float>& a, const std::vector<float>& b, std::uint64_t width, std::uint64_t height)
+{
+    const std::uint64_t window = 8;
+    const std::uint64_t stride = 4;
+    const double c1 = 0.01 * 0.01;
+    const double c2 = 0.03 * 0.03;
+
+    double total = 0.0;
+    std::uint64_t n_windows = 0;
+    for (std::uint64_t wy = 0; wy + window <= height; wy += stride) {
+        for (std::uint64_t wx = 0; wx + window <= width; wx += stride) {
+            double sa = 0.0, sb = 0.0, saa = 0.0, sbb = 0.0, sab = 0.0;
+            for (std::uint64_t y = wy; y < wy + window; ++y) {
+                for (std::uint64_t x = wx; x < wx + window; ++x) {
+                    double va = a[y * width + x];
+                    double vb = b[y * width + x];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+
+            double n = window * window;
+            double ma = sa / n, mb = sb / n;
+            double var_a = saa / n - ma * ma;
+            double var_b = sbb / n - mb * mb;
+            double cov = sab / n - ma * mb;
+
+            total += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (var_a + var_b + c2));
+            ++n_windows;
+        }
+    }
+
+    return n_windows ? total / n_windows : 1.0;
+}
+
+// Default reference file for a render, named after every setting that
+// changes its histogram. The viewport, bands and frames go into a hash.
+std::string reference_name(const RenderConfig& config)
+{
+    std::ostringstream key;
+    key << std::hexfloat << config.re_min.hi << "," << config.re_min.lo << "," << config.re_max.hi << "," << config.re_max.lo << ","
+        << config.im_min.hi << "," << config.im_min.lo << "," << config.im_max.hi << "," << config.im_max.lo;
+    for (const auto& band : config.bands) {
+        key << ";b" << band.first << "-" << band.second;
+    }
+    for (const auto& frame : config.frames) {
+        key << ";f" << frame.first << "-" << frame.second;
+    }
+    if (config.sweep.n_frames > 0) {
+        key << ";s" << config.sweep.lower_end << "," << config.sweep.from << "," << config.sweep.to << "," << config.sweep.n_frames;
+    }
+
+    // 64-bit FNV-1a.
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : key.str()) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+
+    std::ostringstream name;
+    name << "reference-" << image_width(config) << "x" << image_height(config) << "-" << config.max_iter << "-" << config.formula
+         << "-" << config.precision << "-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".hist";
+
+    return name.str();
+}
+
+// Samples config and reduces a banded or framed result to the histogram of
+// its last window, so reference and samplers compare one W x H image.
+std::vector<std::uint64_t> sample_last_window(const RenderConfig& config, const std::vector<std::pair<float, float>>& good_points, RenderStats& stats)
+{
+    std::vector<std::uint64_t> counts = sample_buddhabrot(config, good_points, stats);
+    std::vector<IterWindow> windows = iter_windows(config);
+    if (windows.empty()) {
+        return counts;
+    }
+
+    std::uint64_t n_pixels = image_width(config) * image_height(config);
+    accumulate_bands(counts, n_pixels);
+
+    return window_counts(counts, band_edges(windows), windows.back(), n_pixels);
+}
+
+}
+
+void bench_sampler(const SamplerBenchConfig& config)
+{
+    const RenderConfig& base = config.render;
+    std::uint64_t width = image_width(base);
+    std::uint64_t height = image_height(base);
+    std::string reference_file = config.reference.empty() ? reference_name(base) : config.reference;
+
+    std::vector<std::uint64_t> reference;
+    std::uint64_t reference_samples = 0;
+    try {
+        reference = read_histogram(reference_file, width, height, base.max_iter, reference_samples);
+        std::cout << "Using cached reference " << reference_file << " (" << reference_samples << " samples)\n";
+    } catch (const std::runtime_error&) {
+        RenderConfig render = base;
+        render.p_uniform = 1.0f;
+        render.points_per_thread = config.reference_points / render.n_threads;
+
+        std::cout << "Rendering reference with " << render.points_per_thread * render.n_threads << " uniform samples\n";
+        RenderStats stats;
+        reference = sample_last_window(render, {}, stats);
+        reference_samples = stats.n_samples;
+        write_histogram(reference_file, reference, width, height, base.max_iter, reference_samples);
+        std::cout << "Cached reference in " << reference_file << "\n";
+    }
+    std::vector<float> reference_image = normalized_log_image(reference);
+
+    std::ofstream csv(config.csv);
+    csv << "sampler,samples,cpu_seconds,seed_cpu_seconds,wall_seconds,rmse,ssim\n";
+
+    std::cout << "\n" << std::setfill(' ') << std::setw(32) << std::left << "sampler" << std::right << std::setw(12) << "samples"
+              << std::setw(10) << "cpu s" << std::setw(10) << "seed s" << std::setw(10) << "rmse" << std::setw(8) << "ssim" << "\n";
+
+    for (const auto& [name, sampler] : config.samplers) {
+        double seed_start = cpu_seconds();
+        std::vector<std::pair<float, float>> good_points;
+        if (sampler.p_uniform < 1.0f) {
+            good_points = find_good_points(sampler.size, sampler.seed_max_iter, sampler.n_dilations, false, parse_formula(sampler.formula));
+        }
+        double seed_cpu = cpu_seconds() - seed_start;
+
+        for (std::uint64_t budget : config.budgets) {
+            RenderConfig render = sampler;
+            render.points_per_thread = std::max<std::uint64_t>(1, budget / render.n_threads);
+            render.quiet = true;
+
+            double cpu_start = cpu_seconds();
+            RenderStats stats;
+            std::vector<std::uint64_t> counts = sample_last_window(render, good_points, stats);
+            double cpu = cpu_seconds() - cpu_start;
+
+            std::vector<float> image = normalized_log_image(counts);
+            double error = rmse(image, reference_image);
+            double similarity = ssim(image, reference_image, width, height);
+
+            csv << "\"" << name << "\"," << stats.n_samples << "," << cpu << "," << seed_cpu << "," << stats.sample_seconds << ","
+                << error << "," << similarity << "\n";
+            std::cout << std::setw(32) << std::left << name << std::right << std::setw(12) << stats.n_samples
+                      << std::fixed << std::setw(10) << std::setprecision(2) << cpu << std::setw(10) << seed_cpu
+                      << std::setw(10) << std::setprecision(4) << error << std::setw(8) << std::setprecision(3) << similarity << "\n";
+        }
+    }
+
+    std::cout << "Wrote " << config.csv << "\n";
+}
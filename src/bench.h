@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "render.h"
+
+struct ScalingBenchConfig {
+    RenderConfig render;
+    bool weak = false;
+    std::vector<std::size_t> threads { 1, 2, 4, 8 };
+    std::vector<std::uint64_t> sizes { 1024 };
+    std::vector<std::uint64_t> max_iters { 20, 1000 };
+    std::uint64_t points = 10000000;
+    std::string csv = "scaling.csv";
+};
+
+struct SamplerBenchConfig {
+    RenderConfig render;
+    std::vector<std::pair<std::string, RenderConfig>> samplers;
+    std::vector<std::uint64_t> budgets { 1000000, 4000000, 16000000, 64000000 };
+    std::uint64_t reference_points = 4000000000;
+    std::string reference;
+    std::string csv = "sampler.csv";
+};
+
+std::uint64_t peak_rss_kb();
+void reset_peak_rss();
+
+double cpu_seconds();
+
+void bench_scaling(const ScalingBenchConfig& config);
+void bench_sampler(const SamplerBenchConfig& config);
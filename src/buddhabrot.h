@@ -0,0 +1,751 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cmap.h"
+#include "dispatch.h"
+#include "pool.h"
+#include "seeds.h"
+#include "target.h"
+#include "tiles.h"
+
+// How escaping orbits get to the splat kernel: store keeps the orbit in a
+// max_iter sized buffer while testing for escape, recompute tests first
+// without storing and iterates escaping orbits a second time, adaptive picks
+// recompute for max_iter at or above the threshold or a zoomed viewport,
+// unless escaping orbits account for too much of the pilot samples'
+// iterations.
+enum class OrbitMode {
+    store,
+    recompute,
+    adaptive,
+};
+
+// Counter one thread stores to and others poll, with relaxed ordering since
+// readers only need some recent value. Copies take the current value, which
+// keeps the thread structs holding it copyable.
+struct RelaxedCounter {
+    std::atomic<std::uint64_t> value { 0 };
+
+    RelaxedCounter(std::uint64_t initial = 0)
+        : value(initial)
+    {
+    }
+
+    RelaxedCounter(const RelaxedCounter& other)
+        : value(other.load())
+    {
+    }
+
+    RelaxedCounter& operator=(const RelaxedCounter& other)
+    {
+        store(other.load());
+        return *this;
+    }
+
+    void store(std::uint64_t v)
+    {
+        value.store(v, std::memory_order_relaxed);
+    }
+
+    std::uint64_t load() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+// Seed points a background seed pass publishes while sampling already runs.
+// Until then samples are drawn uniformly, after running the urgent tasks of
+// pool (the seed pass's parallel chunks among them) when it is set. Setting
+// stop abandons the seed pass.
+struct PendingSeeds {
+    std::atomic<const std::vector<std::pair<float, float>>*> points { nullptr };
+    TaskPool* pool = nullptr;
+    std::atomic<bool> stop { false };
+};
+
+template <typename T, Formula F = Formula::mandelbrot>
+struct BuddhabrotThread {
+    kernels::PixelMap<T> view;
+    std::uint64_t max_iter;
+    TiledHistogram counts;
+    float p_uniform;
+    const std::vector<std::pair<float, float>>& good_points;
+    float point_radius;
+    RelaxedCounter progress;
+    std::uint64_t seed = 0;
+    // Replaces good_points when set, once its points are published, and
+    // n_unseeded counts the uniform samples drawn before that.
+    const PendingSeeds* pending_seeds = nullptr;
+    std::uint64_t n_unseeded = 0;
+    // Checked once per batch; sampling stops early once it is set.
+    const std::atomic<bool>* cancelled = nullptr;
+
+    bool prefilter = false;
+    float prefilter_guard = 0.05f;
+    std::uint64_t n_prefiltered = 0;
+    std::uint64_t n_guarded = 0;
+
+    bool specialize = true;
+
+    OrbitMode orbit_mode = OrbitMode::adaptive;
+    std::uint64_t recompute_threshold = 10000;
+    std::uint64_t n_escaped = 0;
+    std::uint64_t n_recomputed = 0;
+
+    // Orbit points (with their conjugates) offered to the splat kernel, how
+    // many of them landed inside the viewport, and escaping orbits rejected
+    // because they never entered it.
+    std::uint64_t n_orbit_points = 0;
+    std::uint64_t n_splatted = 0;
+    std::uint64_t n_outside = 0;
+
+    // Elementary orbit length bands behind frame sequences and Nebulabrot
+    // channels: when set, counts holds one histogram per band, one after the
+    // other, and an orbit escaping after n iterations goes to the band b with
+    // band_edges[b] <= n < band_edges[b + 1]. Orbits outside all bands are
+    // not splatted.
+    std::vector<std::uint64_t> band_edges {};
+
+    // Out-of-core passes: when row_end is set, counts only covers the pixel
+    // rows [row_begin, row_end) of view and orbit points landing in other
+    // rows are dropped.
+    std::uint64_t row_begin = 0;
+    std::uint64_t row_end = 0;
+
+    // Escaping c values kept for a seed database when record_seeds is set.
+    bool record_seeds = false;
+    std::vector<EscapeSeed> seeds {};
+
+    // Further viewports fed from the same orbits, without bands.
+    std::vector<SplatTarget<T>> targets {};
+
+    // Anti-Buddhabrot: bounded orbits are splatted into anti_counts over one
+    // detected cycle, when anti_counts is not empty.
+    TiledHistogram anti_counts {};
+    std::uint64_t n_cycles = 0;
+    std::uint64_t n_aperiodic = 0;
+
+    static constexpr std::size_t batch_size = 64;
+    static constexpr std::size_t splat_chunk = 256;
+    static constexpr std::uint64_t recompute_pilot = 4096;
+    static constexpr double recompute_max_escape = 0.75;
+    static constexpr std::uint64_t max_period = 1024;
+    static constexpr std::size_t no_band = std::numeric_limits<std::size_t>::max();
+
+    // Number types without standard random distributions draw c in double.
+    using Sample = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+
+    // Draws c either uniformly from [-2, 2]^2 or from a box around a random
+    // seed point.
+    struct SampleSource {
+        std::default_random_engine eng;
+        std::uniform_real_distribution<Sample> uniform;
+        std::bernoulli_distribution use_uniform;
+        std::uniform_int_distribution<std::size_t> point_idx_dist;
+        const std::vector<std::pair<float, float>>* good_points;
+        float point_radius;
+        const PendingSeeds* pending;
+        float p_uniform;
+        std::uint64_t n_points;
+        std::uint64_t n_drawn = 0;
+
+        void draw(T* re, T* im, std::size_t n)
+        {
+            if (pending != nullptr) {
+                while (!take_pending() && pending->pool != nullptr && pending->pool->run_one(TaskPool::urgent)) {
+                }
+                if (pending != nullptr) {
+                    for (std::size_t b = 0; b < n; ++b) {
+                        re[b] = uniform(eng);
+                        im[b] = uniform(eng);
+                    }
+                    n_drawn += n;
+                    return;
+                }
+            }
+
+            for (std::size_t b = 0; b < n; ++b) {
+                if (use_uniform(eng)) {
+                    re[b] = uniform(eng);
+                    im[b] = uniform(eng);
+                } else {
+                    auto [rmid, imid] = (*good_points)[point_idx_dist(eng)];
+                    std::uniform_real_distribution<Sample> r_dist(rmid - point_radius, rmid + point_radius);
+                    std::uniform_real_distribution<Sample> i_dist(imid - point_radius, imid + point_radius);
+
+                    re[b] = r_dist(eng);
+                    im[b] = i_dist(eng);
+                }
+            }
+        }
+
+        // Switches to the published seed points, if any yet. Every sample
+        // drawn while waiting was uniform, so the rest of the stream is drawn
+        // uniformly with the probability that keeps the expected uniform share
+        // of all n_points at p_uniform, or none once that share is exceeded.
+        bool take_pending()
+        {
+            const auto* points = pending->points.load(std::memory_order_acquire);
+            if (points == nullptr) {
+                return false;
+            }
+
+            double p = 1.0;
+            if (!points->empty() && n_drawn < n_points) {
+                p = std::clamp((static_cast<double>(p_uniform) * n_points - n_drawn) / (n_points - n_drawn), 0.0, 1.0);
+            }
+            use_uniform = std::bernoulli_distribution(p);
+            point_idx_dist = std::uniform_int_distribution<std::size_t>(0, points->size() - 1);
+            good_points = points;
+            pending = nullptr;
+
+            return true;
+        }
+    };
+
+    // Where a stream sampled over several sample() calls stands: its source
+    // with the engine state, the next sample, the end of the current call's
+    // range and the orbit mode the pilot has settled on so far.
+    struct StreamState {
+        std::optional<SampleSource> source;
+        std::uint64_t next = 0;
+        std::uint64_t end = 0;
+        bool recompute = false;
+        bool piloting = false;
+        std::uint64_t pilot_iters = 0;
+        std::uint64_t pilot_escaped_iters = 0;
+    };
+    StreamState stream {};
+
+    SampleSource make_source(std::uint64_t n_points) const
+    {
+        std::random_device rd;
+        return {
+            std::default_random_engine(seed != 0 ? seed : rd()),
+            std::uniform_real_distribution(Sample{-2.0}, Sample{2.0}),
+            std::bernoulli_distribution(p_uniform),
+            std::uniform_int_distribution<std::size_t>(0, good_points.size() - 1),
+            &good_points,
+            point_radius,
+            pending_seeds,
+            p_uniform,
+            n_points
+        };
+    }
+
+    // Draws and splats the next n_chunk samples (rounded up to whole
+    // batches) of a stream of n_points, continuing where the previous call
+    // stopped, so a stream split over several calls matches a single one.
+    // Returns true once the stream is finished or stopped.
+    bool sample(std::uint64_t n_points, std::uint64_t n_chunk = std::numeric_limits<std::uint64_t>::max())
+    {
+        std::uint64_t n_batches = std::max<std::uint64_t>(1, n_chunk / batch_size + (n_chunk % batch_size != 0));
+        std::uint64_t n_remaining = (n_points - stream.next + batch_size - 1) / batch_size;
+        stream.end = n_batches >= n_remaining ? n_points : stream.next + n_batches * batch_size;
+        run_stream(n_points);
+
+        return stream.next >= n_points || stopped();
+    }
+
+    // Samples stream.next up to stream.end with the sample_impl
+    // instantiation matching this thread's settings.
+    void run_stream(std::uint64_t n_points)
+    {
+        if constexpr (F != Formula::mandelbrot) {
+            sample_impl<0, 0>(n_points);
+        } else if (specialize) {
+            dispatch_max_iter<20, 50, 100, 200, 500, 1000>(n_points);
+        } else {
+            sample_impl<0, 0>(n_points);
+        }
+    }
+
+    // Picks the sample_impl instantiation for the runtime max_iter and size,
+    // falling back to the generic (0) parameter when no bucket matches.
+    template <std::uint64_t MaxIter, std::uint64_t... Rest>
+    void dispatch_max_iter(std::uint64_t n_points)
+    {
+        if (max_iter == MaxIter) {
+            dispatch_size<MaxIter, 10, 11, 12, 13>(n_points);
+        } else if constexpr (sizeof...(Rest) > 0) {
+            dispatch_max_iter<Rest...>(n_points);
+        } else {
+            dispatch_size<0, 10, 11, 12, 13>(n_points);
+        }
+    }
+
+    template <std::uint64_t MaxIter, std::uint32_t SizeLog2, std::uint32_t... Rest>
+    void dispatch_size(std::uint64_t n_points)
+    {
+        if (view.width == view.height && view.width == (std::uint64_t { 1 } << SizeLog2)) {
+            sample_impl<MaxIter, SizeLog2>(n_points);
+        } else if constexpr (sizeof...(Rest) > 0) {
+            dispatch_size<MaxIter, Rest...>(n_points);
+        } else {
+            sample_impl<MaxIter, 0>(n_points);
+        }
+    }
+
+    // MaxIter and SizeLog2 fix max_iter and a square power-of-two output size
+    // at compile time when nonzero, which lets the orbit loop use a fixed-size
+    // buffer and known trip count and turns pixel indexing into shifts.
+    template <std::uint64_t MaxIter, std::uint32_t SizeLog2>
+    void sample_impl(std::uint64_t n_points)
+    {
+        const std::uint64_t max_iter = MaxIter != 0 ? MaxIter : this->max_iter;
+        const kernels::PixelMap<T> reach = splat_reach();
+        const bool track_viewport = reach.zoomed();
+
+        if (!stream.source) {
+            stream.source = make_source(n_points);
+            stream.recompute = orbit_mode == OrbitMode::recompute || (orbit_mode == OrbitMode::adaptive && (max_iter >= recompute_threshold || track_viewport));
+            stream.piloting = orbit_mode == OrbitMode::adaptive && stream.recompute;
+        }
+        SampleSource& source = *stream.source;
+        bool& recompute = stream.recompute;
+        bool& piloting = stream.piloting;
+        std::uint64_t& pilot_iters = stream.pilot_iters;
+        std::uint64_t& pilot_escaped_iters = stream.pilot_escaped_iters;
+
+        using OrbitBuffer = std::conditional_t<MaxIter != 0, std::array<T, MaxIter>, std::vector<T>>;
+        OrbitBuffer orbit_re, orbit_im;
+        auto allocate_orbit = [&] {
+            if constexpr (MaxIter == 0) {
+                orbit_re.resize(max_iter);
+                orbit_im.resize(max_iter);
+            }
+        };
+        if (!recompute) {
+            allocate_orbit();
+        }
+
+        std::array<T, batch_size> batch_re, batch_im, final_re, final_im, peaks;
+        std::array<std::uint64_t, batch_size> iters;
+        std::array<std::uint8_t, batch_size> entered;
+        std::array<bool, batch_size> candidate;
+        candidate.fill(true);
+
+        std::uint64_t k = stream.next;
+        for (; k < stream.end && !stopped(); k += batch_size) {
+            progress.store(k + 1);
+            std::size_t n_batch = std::min<std::uint64_t>(batch_size, n_points - k);
+
+            source.draw(batch_re.data(), batch_im.data(), n_batch);
+
+            if (recompute) {
+                // The lane kernel runs the same loop as below, so iters is
+                // the stored orbit length and escaping orbits replay exactly.
+                // Orbits that never come near a zoomed viewport are dropped
+                // here, before the second pass.
+                escape_batch(batch_re.data(), batch_im.data(), n_batch, max_iter, track_viewport ? &reach : nullptr, iters.data(), final_re.data(), final_im.data(), peaks.data(), entered.data());
+                for (std::size_t b = 0; b < n_batch; ++b) {
+                    pilot_iters += iters[b];
+                    if (final_re[b] * final_re[b] + final_im[b] * final_im[b] >= T{4.0}) {
+                        escaped(batch_re[b], batch_im[b], iters[b]);
+                        std::size_t band = band_of(iters[b]);
+                        if (band != no_band && reject_outside(track_viewport, entered[b], iters[b])) {
+                            continue;
+                        }
+                        if (band != no_band) {
+                            pilot_escaped_iters += iters[b];
+                            splat_recomputed<SizeLog2>(batch_re[b], batch_im[b], iters[b], band);
+                        }
+                    } else if (!anti_counts.empty()) {
+                        splat_cycle(batch_re[b], batch_im[b], final_re[b], final_im[b]);
+                    }
+                }
+                n_recomputed += n_batch;
+
+                // The second pass costs the escaping orbits' iterations again,
+                // so fall back to storing when those dominate.
+                if (piloting && k + n_batch >= recompute_pilot) {
+                    piloting = false;
+                    if (pilot_escaped_iters > recompute_max_escape * pilot_iters) {
+                        recompute = false;
+                        allocate_orbit();
+                    }
+                }
+                continue;
+            }
+
+            if (prefilter) {
+                classify_batch(batch_re.data(), batch_im.data(), n_batch, candidate.data());
+            }
+
+            for (std::size_t b = 0; b < n_batch; ++b) {
+                if (!candidate[b]) {
+                    continue;
+                }
+
+                // Same operation order as std::complex<T> z = z * z + c, kept
+                // as separate re/im arrays for the splat kernel.
+                const T cr = batch_re[b];
+                const T ci = batch_im[b];
+                T zr {}, zi {};
+                std::uint64_t n_orbit = 0;
+
+                for (; n_orbit < max_iter && zr * zr + zi * zi < T{8.0}; ++n_orbit) {
+                    T nr, ni;
+                    kernels::iterate<F>(zr, zi, cr, ci, nr, ni);
+                    zr = nr;
+                    zi = ni;
+                    orbit_re[n_orbit] = zr;
+                    orbit_im[n_orbit] = zi;
+                }
+
+                if (zr * zr + zi * zi < T{4.0}) {
+                    if (!anti_counts.empty()) {
+                        splat_cycle(cr, ci, zr, zi);
+                    }
+                    continue;
+                }
+
+                escaped(cr, ci, n_orbit);
+                std::size_t band = band_of(n_orbit);
+                for (std::uint64_t i = 0; i < n_orbit && band != no_band; i += splat_chunk) {
+                    splat<SizeLog2>(orbit_re.data() + i, orbit_im.data() + i, std::min<std::uint64_t>(splat_chunk, n_orbit - i), band);
+                }
+            }
+        }
+        stream.next = k;
+        if (k < n_points && !stopped()) {
+            return;
+        }
+
+        n_unseeded = source.n_drawn;
+        progress.store(n_points);
+    }
+
+    // Escape search for the pipelined sampler: draws n_points samples exactly
+    // like sample() and hands each escaping c with its orbit length to push.
+    // Only bounded orbits are splatted here, into anti_counts.
+    template <typename Push>
+    void find(std::uint64_t n_points, Push&& push)
+    {
+        SampleSource source = make_source(n_points);
+        const kernels::PixelMap<T> reach = splat_reach();
+        const bool track_viewport = reach.zoomed();
+        std::array<T, batch_size> batch_re, batch_im, final_re, final_im, peaks;
+        std::array<std::uint64_t, batch_size> iters;
+        std::array<std::uint8_t, batch_size> entered;
+
+        for (std::uint64_t k = 0; k < n_points && !stopped(); k += batch_size) {
+            progress.store(k + 1);
+            std::size_t n_batch = std::min<std::uint64_t>(batch_size, n_points - k);
+
+            source.draw(batch_re.data(), batch_im.data(), n_batch);
+            escape_batch(batch_re.data(), batch_im.data(), n_batch, max_iter, track_viewport ? &reach : nullptr, iters.data(), final_re.data(), final_im.data(), peaks.data(), entered.data());
+            for (std::size_t b = 0; b < n_batch; ++b) {
+                if (final_re[b] * final_re[b] + final_im[b] * final_im[b] >= T{4.0}) {
+                    escaped(batch_re[b], batch_im[b], iters[b]);
+                    if (band_of(iters[b]) != no_band && !reject_outside(track_viewport, entered[b], iters[b])) {
+                        push(batch_re[b], batch_im[b], iters[b]);
+                    }
+                } else if (!anti_counts.empty()) {
+                    splat_cycle(batch_re[b], batch_im[b], final_re[b], final_im[b]);
+                }
+            }
+        }
+
+        n_unseeded = source.n_drawn;
+        progress.store(n_points);
+    }
+
+    // Replays every stride-th of n_seeds recorded seeds. The escape test runs
+    // again on the dequantized c, since quantization can change the orbit,
+    // and orbits that still escape are splatted like in recompute mode.
+    void replay(const EscapeSeed* first, std::size_t n_seeds, std::size_t stride)
+    {
+        const kernels::PixelMap<T> reach = splat_reach();
+        const bool track_viewport = reach.zoomed();
+        std::array<T, batch_size> batch_re, batch_im, final_re, final_im, peaks;
+        std::array<std::uint64_t, batch_size> iters;
+        std::array<std::uint8_t, batch_size> entered;
+
+        std::uint64_t n_points = (n_seeds + stride - 1) / stride;
+        for (std::uint64_t k = 0; k < n_points && !stopped(); k += batch_size) {
+            progress.store(k + 1);
+            std::size_t n_batch = std::min<std::uint64_t>(batch_size, n_points - k);
+
+            for (std::size_t b = 0; b < n_batch; ++b) {
+                const EscapeSeed& seed = first[(k + b) * stride];
+                batch_re[b] = static_cast<T>(dequantize_seed(seed.re));
+                batch_im[b] = static_cast<T>(dequantize_seed(seed.im));
+            }
+
+            escape_batch(batch_re.data(), batch_im.data(), n_batch, max_iter, track_viewport ? &reach : nullptr, iters.data(), final_re.data(), final_im.data(), peaks.data(), entered.data());
+            for (std::size_t b = 0; b < n_batch; ++b) {
+                if (final_re[b] * final_re[b] + final_im[b] * final_im[b] < T{4.0}) {
+                    continue;
+                }
+
+                ++n_escaped;
+                std::size_t band = band_of(iters[b]);
+                if (band != no_band && !reject_outside(track_viewport, entered[b], iters[b])) {
+                    splat_recomputed<0>(batch_re[b], batch_im[b], iters[b], band);
+                }
+            }
+        }
+
+        progress.store(n_points);
+    }
+
+    void escaped(T cr, T ci, std::uint64_t n_orbit)
+    {
+        ++n_escaped;
+        if (record_seeds) {
+            seeds.push_back({ quantize_seed(static_cast<double>(cr)), quantize_seed(static_cast<double>(ci)), static_cast<std::uint32_t>(n_orbit) });
+        }
+    }
+
+    void splat_orbit(T cr, T ci, std::uint64_t n_orbit)
+    {
+        splat_recomputed<0>(cr, ci, n_orbit, band_of(n_orbit));
+    }
+
+    bool stopped() const
+    {
+        return cancelled != nullptr && cancelled->load(std::memory_order_relaxed);
+    }
+
+    // Bounding box of the main view and all targets; only its bounds are
+    // meaningful.
+    kernels::PixelMap<T> splat_reach() const
+    {
+        kernels::PixelMap<T> reach = view;
+        if (row_end != 0) {
+            // A margin of two rows absorbs rounding in the pixel mapping.
+            T lo = view.im_min + static_cast<T>(static_cast<double>(row_begin) - 2.0) / view.scale_y;
+            T hi = view.im_min + static_cast<T>(static_cast<double>(row_end) + 2.0) / view.scale_y;
+            reach.im_min = std::max(reach.im_min, lo);
+            reach.im_max = std::min(reach.im_max, hi);
+        }
+        for (const auto& target : targets) {
+            reach.re_min = std::min(reach.re_min, target.view.re_min);
+            reach.re_max = std::max(reach.re_max, target.view.re_max);
+            reach.im_min = std::min(reach.im_min, target.view.im_min);
+            reach.im_max = std::max(reach.im_max, target.view.im_max);
+        }
+        return reach;
+    }
+
+    // Store-free escape test of a batch, also reporting which orbits enter
+    // reach when it is given.
+    void escape_batch(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, const kernels::PixelMap<T>* reach, std::uint64_t* iters, T* zr, T* zi, T* peaks, std::uint8_t* entered)
+    {
+        if (reach != nullptr) {
+            ::escape_viewport<F>(cr, ci, n, max_iter, T{8.0}, *reach, iters, zr, zi, entered);
+        } else {
+            escape_iterations<F>(cr, ci, n, max_iter, T{8.0}, iters, zr, zi, peaks);
+        }
+    }
+
+    // Counts an escaping orbit that never entered a tracked viewport as
+    // splatted entirely outside it, and tells the caller to skip it.
+    bool reject_outside(bool tracked, std::uint8_t entered, std::uint64_t n_orbit)
+    {
+        if (!tracked || entered) {
+            return false;
+        }
+
+        ++n_outside;
+        n_orbit_points += view.n_images() * n_orbit;
+        return true;
+    }
+
+    // Pixels of one band plane of counts.
+    std::uint64_t strip_pixels() const
+    {
+        return (row_end != 0 ? row_end - row_begin : view.height) * view.width;
+    }
+
+    std::size_t band_of(std::uint64_t n_orbit) const
+    {
+        if (band_edges.empty()) {
+            return 0;
+        }
+        if (n_orbit < band_edges.front() || n_orbit >= band_edges.back()) {
+            return no_band;
+        }
+
+        return std::upper_bound(band_edges.begin(), band_edges.end(), n_orbit) - band_edges.begin() - 1;
+    }
+
+    // With SizeLog2 set the dispatched kernel has the output size as a
+    // constant, so pixel indexing becomes shifts.
+    template <std::uint32_t SizeLog2>
+    void splat(const T* re, const T* im, std::size_t n, std::size_t band)
+    {
+        std::array<std::uint64_t, 2 * splat_chunk> indices;
+        std::size_t n_indices;
+        if constexpr (SizeLog2 != 0) {
+            n_indices = ::orbit_pixels_pow2<SizeLog2>(re, im, n, view, indices.data());
+        } else {
+            n_indices = ::orbit_pixels(re, im, n, view, indices.data());
+        }
+        n_orbit_points += view.n_images() * n;
+
+        std::uint64_t n_pixels = strip_pixels();
+        if (row_end != 0) {
+            std::uint64_t first = row_begin * view.width;
+            std::size_t n_kept = 0;
+            for (std::size_t i = 0; i < n_indices; ++i) {
+                std::uint64_t pixel = indices[i] - first;
+                indices[n_kept] = pixel;
+                n_kept += pixel < n_pixels;
+            }
+            n_indices = n_kept;
+        }
+        n_splatted += n_indices;
+
+        std::uint64_t plane = band * n_pixels;
+        for (std::size_t i = 0; i < n_indices; ++i) {
+            counts.add(plane + indices[i]);
+        }
+
+        for (auto& target : targets) {
+            std::size_t n_target = ::orbit_pixels(re, im, n, target.view, indices.data());
+            target.add(indices.data(), n_target);
+        }
+    }
+
+    // Iterates an orbit known to escape after n_orbit steps a second time,
+    // splatting it in chunks small enough to stay in L1.
+    template <std::uint32_t SizeLog2>
+    void splat_recomputed(T cr, T ci, std::uint64_t n_orbit, std::size_t band)
+    {
+        std::array<T, splat_chunk> re, im;
+        T zr {}, zi {};
+
+        for (std::uint64_t i = 0; i < n_orbit; i += splat_chunk) {
+            std::size_t n = std::min<std::uint64_t>(splat_chunk, n_orbit - i);
+            for (std::size_t j = 0; j < n; ++j) {
+                T nr, ni;
+                kernels::iterate<F>(zr, zi, cr, ci, nr, ni);
+                zr = nr;
+                zi = ni;
+                re[j] = zr;
+                im[j] = zi;
+            }
+            splat<SizeLog2>(re.data(), im.data(), n, band);
+        }
+    }
+
+    // Brent's cycle detection continued from the last point z of a bounded
+    // orbit, with points closer than sqrt(epsilon) of the sampling type
+    // treated as equal. Returns
+    // the period and leaves z on the cycle, or 0 when no cycle of at most
+    // max_period points shows up within about 2 * max_period steps.
+    static std::uint64_t find_period(T cr, T ci, T& zr, T& zi)
+    {
+        const T tolerance = std::numeric_limits<Sample>::epsilon();
+        T tr = zr, ti = zi;
+        T hr, hi;
+        kernels::iterate<F>(zr, zi, cr, ci, hr, hi);
+        std::uint64_t power = 1;
+        std::uint64_t period = 1;
+
+        while (power <= max_period) {
+            T dr = hr - tr, di = hi - ti;
+            if (dr * dr + di * di <= tolerance) {
+                zr = hr;
+                zi = hi;
+                return period;
+            }
+            if (power == period) {
+                tr = hr;
+                ti = hi;
+                power *= 2;
+                period = 0;
+            }
+            T nr, ni;
+            kernels::iterate<F>(hr, hi, cr, ci, nr, ni);
+            hr = nr;
+            hi = ni;
+            ++period;
+        }
+
+        return 0;
+    }
+
+    void splat_cycle(T cr, T ci, T zr, T zi)
+    {
+        std::uint64_t period = find_period(cr, ci, zr, zi);
+        if (period == 0) {
+            ++n_aperiodic;
+            return;
+        }
+        ++n_cycles;
+
+        std::array<T, splat_chunk> re, im;
+        std::array<std::uint64_t, 2 * splat_chunk> indices;
+        for (std::uint64_t i = 0; i < period; i += splat_chunk) {
+            std::size_t n = std::min<std::uint64_t>(splat_chunk, period - i);
+            for (std::size_t j = 0; j < n; ++j) {
+                re[j] = zr;
+                im[j] = zi;
+                T nr, ni;
+                kernels::iterate<F>(zr, zi, cr, ci, nr, ni);
+                zr = nr;
+                zi = ni;
+            }
+
+            std::size_t n_indices = ::orbit_pixels(re.data(), im.data(), n, view, indices.data());
+            for (std::size_t k = 0; k < n_indices; ++k) {
+                anti_counts.add(indices[k]);
+            }
+        }
+    }
+
+    // Float escape test for a batch of c. Orbits that stay bounded in float are
+    // dropped unless they came within the guard band of the bailout, where
+    // float rounding could flip the outcome; everything else is recomputed in
+    // full precision.
+    void classify_batch(const T* batch_re, const T* batch_im, std::size_t n_batch, bool* candidate)
+    {
+        std::array<float, batch_size> cr, ci, zr, zi, peaks;
+        std::array<std::uint64_t, batch_size> iters;
+        for (std::size_t b = 0; b < n_batch; ++b) {
+            cr[b] = static_cast<float>(batch_re[b]);
+            ci[b] = static_cast<float>(batch_im[b]);
+        }
+
+        escape_iterations<F>(cr.data(), ci.data(), n_batch, max_iter, 8.0f, iters.data(), zr.data(), zi.data(), peaks.data());
+
+        float guard = 4.0f * (1.0f - prefilter_guard);
+        for (std::size_t b = 0; b < n_batch; ++b) {
+            bool escaped = zr[b] * zr[b] + zi[b] * zi[b] >= 4.0f;
+            bool guarded = !escaped && peaks[b] >= guard;
+            candidate[b] = escaped || guarded;
+            n_prefiltered += !candidate[b];
+            n_guarded += guarded;
+        }
+    }
+};
+
+// Sums the threads' histogram (counts unless another member is given), each
+// task merging one range of tiles from every thread.
+template <typename Thread>
+std::vector<std::uint64_t> merge_results(const std::vector<Thread>& threads, TaskPool& pool = default_pool(), TiledHistogram Thread::*histogram = &Thread::counts)
+{
+    std::vector<std::uint64_t> result((threads.front().*histogram).size());
+
+    parallel_for(0, (threads.front().*histogram).n_tiles(), 16, [&](std::size_t begin, std::size_t end) {
+        for (const auto& thread : threads) {
+            (thread.*histogram).add_to(result, begin, end);
+        }
+    }, pool);
+
+    return result;
+}
@@ -12,7 +12,8 @@
 template <typename T>
 T remap(T from_lo, T from_hi, T to_lo, T to_hi, T v)
 {
-    return std::lerp(to_lo, to_hi,
+    using std::lerp;
+    return lerp(to_lo, to_hi,
         std::clamp((v - from_lo) / (from_hi - from_lo), T { 0 }, T { 1 }));
 }
 
@@ -28,6 +29,8 @@ public:
     {
     }
 
+    const std::vector<std::array<T, 3>>& table() const { return cmap; }
+
     void set_vrange(T new_vmin, T new_vmax) {
         vmin = new_vmin;
         vmax = new_vmax;
@@ -36,7 +39,7 @@ public:
     std::array<T, 3> operator()(T v) const
     {
         T v_scaled = remap(vmin, vmax, T{0}, static_cast<T>(cmap.size() - 1), v);
-        std::size_t left = static_cast<int>(v_scaled);
+        std::size_t left = std::min(static_cast<std::size_t>(v_scaled), cmap.size() - 2);
         std::size_t right = left + 1;
         T frac = v_scaled - left;
 
@@ -0,0 +1,253 @@
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dispatch.h"
+#include "double_double.h"
+#include "formula.h"
+#include "kernels.h"
+
+// One instantiation per Formula, in declaration order.
+#define PER_FORMULA(fn) \
+    { fn<Formula::mandelbrot>, fn<Formula::multibrot3>, fn<Formula::multibrot4>, fn<Formula::multibrot5>, fn<Formula::multibrot6>, fn<Formula::tricorn>, fn<Formula::burning_ship> }
+static_assert(n_formulas == 7, "PER_FORMULA must list every formula");
+
+// One instantiation per specialized output size, smallest first.
+#define PER_POW2_SIZE(fn) \
+    { fn<10>, fn<11>, fn<12>, fn<13> }
+static_assert(pow2_log2_min == 10 && n_pow2_sizes == 4, "PER_POW2_SIZE must list every specialized size");
+
+// Stamps out one set of kernel entry points compiled for the given target.
+// The bodies in kernels.h are always_inline, so each set is vectorized for
+// its own ISA without mixing instantiations across variants. fma tells the
+// double-double kernels whether the target has FMA for their products.
+#define DEFINE_KERNEL_VARIANTS(ns, target, fma) \
+    namespace ns { \
+        using DoubleDoubleLanes = BasicDoubleDouble<fma>; \
+        template <Formula F> \
+        target void escape_iterations_f32(const float* cr, const float* ci, std::size_t n, std::uint64_t max_iter, float bailout, std::uint64_t* iters, float* zr, float* zi, float* peaks) \
+        { \
+            kernels::escape_iterations<F>(cr, ci, n, max_iter, bailout, iters, zr, zi, peaks); \
+        } \
+        template <Formula F> \
+        target void escape_iterations_f64(const double* cr, const double* ci, std::size_t n, std::uint64_t max_iter, double bailout, std::uint64_t* iters, double* zr, double* zi, double* peaks) \
+        { \
+            kernels::escape_iterations<F>(cr, ci, n, max_iter, bailout, iters, zr, zi, peaks); \
+        } \
+        template <Formula F> \
+        target void escape_viewport_f32(const float* cr, const float* ci, std::size_t n, std::uint64_t max_iter, float bailout, const kernels::PixelMap<float>& map, std::uint64_t* iters, float* zr, float* zi, std::uint8_t* entered) \
+        { \
+            kernels::escape_viewport<F>(cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered); \
+        } \
+        template <Formula F> \
+        target void escape_viewport_f64(const double* cr, const double* ci, std::size_t n, std::uint64_t max_iter, double bailout, const kernels::PixelMap<double>& map, std::uint64_t* iters, double* zr, double* zi, std::uint8_t* entered) \
+        { \
+            kernels::escape_viewport<F>(cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered); \
+        } \
+        template <Formula F> \
+        target void escape_iterations_dd(const DoubleDouble* cr, const DoubleDouble* ci, std::size_t n, std::uint64_t max_iter, DoubleDouble bailout, std::uint64_t* iters, DoubleDouble* zr, DoubleDouble* zi, DoubleDouble* peaks) \
+        { \
+            kernels::escape_iterations<F, DoubleDouble, DoubleDoubleLanes>(cr, ci, n, max_iter, bailout, iters, zr, zi, peaks); \
+        } \
+        template <Formula F> \
+        target void escape_viewport_dd(const DoubleDouble* cr, const DoubleDouble* ci, std::size_t n, std::uint64_t max_iter, DoubleDouble bailout, const kernels::PixelMap<DoubleDouble>& map, std::uint64_t* iters, DoubleDouble* zr, DoubleDouble* zi, std::uint8_t* entered) \
+        { \
+            kernels::escape_viewport<F, DoubleDouble, DoubleDoubleLanes>(cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered); \
+        } \
+        target std::size_t orbit_pixels_f32(const float* re, const float* im, std::size_t n, const kernels::PixelMap<float>& map, std::uint64_t* indices) \
+        { \
+            return kernels::orbit_pixels(re, im, n, map, indices); \
+        } \
+        target std::size_t orbit_pixels_f64(const double* re, const double* im, std::size_t n, const kernels::PixelMap<double>& map, std::uint64_t* indices) \
+        { \
+            return kernels::orbit_pixels(re, im, n, map, indices); \
+        } \
+        target std::size_t orbit_pixels_dd(const DoubleDouble* re, const DoubleDouble* im, std::size_t n, const kernels::PixelMap<DoubleDouble>& map, std::uint64_t* indices) \
+        { \
+            return kernels::orbit_pixels(re, im, n, map, indices); \
+        } \
+        template <std::uint32_t SizeLog2, typename T> \
+        target std::size_t orbit_pixels_fixed(const T* re, const T* im, std::size_t n, const kernels::PixelMap<T>& map, std::uint64_t* indices) \
+        { \
+            kernels::PixelMap<T> fixed = map; \
+            fixed.width = std::uint64_t { 1 } << SizeLog2; \
+            fixed.height = std::uint64_t { 1 } << SizeLog2; \
+            return kernels::orbit_pixels(re, im, n, fixed, indices); \
+        } \
+        template <std::uint32_t SizeLog2> \
+        target std::size_t orbit_pixels_pow2_f32(const float* re, const float* im, std::size_t n, const kernels::PixelMap<float>& map, std::uint64_t* indices) \
+        { \
+            return orbit_pixels_fixed<SizeLog2>(re, im, n, map, indices); \
+        } \
+        template <std::uint32_t SizeLog2> \
+        target std::size_t orbit_pixels_pow2_f64(const double* re, const double* im, std::size_t n, const kernels::PixelMap<double>& map, std::uint64_t* indices) \
+        { \
+            return orbit_pixels_fixed<SizeLog2>(re, im, n, map, indices); \
+        } \
+        template <std::uint32_t SizeLog2> \
+        target std::size_t orbit_pixels_pow2_dd(const DoubleDouble* re, const DoubleDouble* im, std::size_t n, const kernels::PixelMap<DoubleDouble>& map, std::uint64_t* indices) \
+        { \
+            return orbit_pixels_fixed<SizeLog2>(re, im, n, map, indices); \
+        } \
+        target void edge(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride) \
+        { \
+            kernels::edge(im, out, begin, end, stride); \
+        } \
+        target void dilate(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride) \
+        { \
+            kernels::dilate(im, out, begin, end, stride); \
+        } \
+        target void log_counts(const std::uint64_t* counts, std::size_t n, float* out) \
+        { \
+            kernels::log_counts(counts, n, out); \
+        } \
+        target void tone_map(const float* values, std::size_t n, const float* table, std::size_t table_size, float vmin, float vmax, std::uint8_t* rgb) \
+        { \
+            kernels::tone_map(values, n, table, table_size, vmin, vmax, rgb); \
+        } \
+        const KernelTable table { \
+            PER_FORMULA(escape_iterations_f32), \
+            PER_FORMULA(escape_iterations_f64), \
+            PER_FORMULA(escape_viewport_f32), \
+            PER_FORMULA(escape_viewport_f64), \
+            PER_FORMULA(escape_iterations_dd), \
+            PER_FORMULA(escape_viewport_dd), \
+            orbit_pixels_f32, \
+            orbit_pixels_f64, \
+            orbit_pixels_dd, \
+            PER_POW2_SIZE(orbit_pixels_pow2_f32), \
+            PER_POW2_SIZE(orbit_pixels_pow2_f64), \
+            PER_POW2_SIZE(orbit_pixels_pow2_dd), \
+            edge, \
+            dilate, \
+            log_counts, \
+            tone_map, \
+        }; \
+    }
+
+#define NO_TARGET
+
+DEFINE_KERNEL_VARIANTS(sse2, NO_TARGET, dd::native_fma)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_VARIANTS
+DEFINE_KERNEL_VARIANTS(avx2, [[gnu::target("avx2,fma,bmi2")]], true)
+DEFINE_KERNEL_VARIANTS(avx512, [[gnu::target("avx512f,avx512bw,avx512vl,avx512dq,avx2,fma,bmi2")]], true)
+#endif
+
+namespace {
+
+std::atomic<const KernelTable*> active_table = nullptr;
+std::atomic<Isa> active = Isa::sse2;
+
+const KernelTable& table_for(Isa isa)
+{
+    switch (isa) {
+#ifdef HAS_X86_VARIANTS
+    case Isa::avx2:
+        return avx2::table;
+    case Isa::avx512:
+        return avx512::table;
+#endif
+    default:
+        return sse2::table;
+    }
+}
+
+}
+
+const char* isa_name(Isa isa)
+{
+    switch (isa) {
+    case Isa::avx2:
+        return "avx2";
+    case Isa::avx512:
+        return "avx512";
+    default:
+        return "sse2";
+    }
+}
+
+Isa parse_isa(const std::string& name)
+{
+    if (name == "sse2") {
+        return Isa::sse2;
+    } else if (name == "avx2") {
+        return Isa::avx2;
+    } else if (name == "avx512") {
+        return Isa::avx512;
+    }
+
+    throw std::invalid_argument("Invalid ISA " + name);
+}
+
+bool isa_supported(Isa isa)
+{
+#ifdef HAS_X86_VARIANTS
+    __builtin_cpu_init();
+    switch (isa) {
+    case Isa::avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2");
+    case Isa::avx512:
+        return isa_supported(Isa::avx2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq");
+    default:
+        return true;
+    }
+#else
+    return isa == Isa::sse2;
+#endif
+}
+
+std::vector<Isa> supported_isas()
+{
+    std::vector<Isa> result;
+    for (Isa isa : { Isa::sse2, Isa::avx2, Isa::avx512 }) {
+        if (isa_supported(isa)) {
+            result.push_back(isa);
+        }
+    }
+
+    return result;
+}
+
+Isa best_isa()
+{
+    return supported_isas().back();
+}
+
+Isa select_isa(const std::string& name)
+{
+    Isa isa = name == "auto" ? best_isa() : parse_isa(name);
+    if (!isa_supported(isa)) {
+        throw std::invalid_argument(std::string("ISA ") + isa_name(isa) + " is not supported by this CPU");
+    }
+    select_isa(isa);
+
+    return isa;
+}
+
+void select_isa(Isa isa)
+{
+    active = isa;
+    active_table = &table_for(isa);
+}
+
+Isa active_isa()
+{
+    if (!active_table) {
+        select_isa(best_isa());
+    }
+
+    return active;
+}
+
+const KernelTable& active_kernels()
+{
+    if (!active_table) {
+        select_isa(best_isa());
+    }
+
+    return *active_table;
+}
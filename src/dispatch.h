@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "double_double.h"
+#include "formula.h"
+#include "kernels.h"
+
+enum class Isa {
+    sse2,
+    avx2,
+    avx512,
+};
+
+// Square power-of-two output sizes 2^pow2_log2_min to 2^pow2_log2_max get
+// orbit_pixels variants with the size fixed at compile time.
+constexpr std::uint32_t pow2_log2_min = 10;
+constexpr std::uint32_t pow2_log2_max = 13;
+constexpr std::size_t n_pow2_sizes = pow2_log2_max - pow2_log2_min + 1;
+
+template <typename T>
+using EscapeIterationsFn = void (*)(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, std::uint64_t* iters, T* zr, T* zi, T* peaks);
+
+template <typename T>
+using EscapeViewportFn = void (*)(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, const kernels::PixelMap<T>& map, std::uint64_t* iters, T* zr, T* zi, std::uint8_t* entered);
+
+template <typename T>
+using OrbitPixelsFn = std::size_t (*)(const T* re, const T* im, std::size_t n, const kernels::PixelMap<T>& map, std::uint64_t* indices);
+
+struct KernelTable {
+    // Escape kernels are indexed by Formula.
+    std::array<EscapeIterationsFn<float>, n_formulas> escape_iterations_f32;
+    std::array<EscapeIterationsFn<double>, n_formulas> escape_iterations_f64;
+    std::array<EscapeViewportFn<float>, n_formulas> escape_viewport_f32;
+    std::array<EscapeViewportFn<double>, n_formulas> escape_viewport_f64;
+    std::array<EscapeIterationsFn<DoubleDouble>, n_formulas> escape_iterations_dd;
+    std::array<EscapeViewportFn<DoubleDouble>, n_formulas> escape_viewport_dd;
+    std::size_t (*orbit_pixels_f32)(const float* re, const float* im, std::size_t n, const kernels::PixelMap<float>& map, std::uint64_t* indices);
+    std::size_t (*orbit_pixels_f64)(const double* re, const double* im, std::size_t n, const kernels::PixelMap<double>& map, std::uint64_t* indices);
+    std::size_t (*orbit_pixels_dd)(const DoubleDouble* re, const DoubleDouble* im, std::size_t n, const kernels::PixelMap<DoubleDouble>& map, std::uint64_t* indices);
+    // Size-specialized orbit_pixels, indexed by SizeLog2 - pow2_log2_min. The
+    // map's width and height are ignored.
+    std::array<OrbitPixelsFn<float>, n_pow2_sizes> orbit_pixels_pow2_f32;
+    std::array<OrbitPixelsFn<double>, n_pow2_sizes> orbit_pixels_pow2_f64;
+    std::array<OrbitPixelsFn<DoubleDouble>, n_pow2_sizes> orbit_pixels_pow2_dd;
+    void (*edge)(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride);
+    void (*dilate)(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride);
+    void (*log_counts)(const std::uint64_t* counts, std::size_t n, float* out);
+    void (*tone_map)(const float* values, std::size_t n, const float* table, std::size_t table_size, float vmin, float vmax, std::uint8_t* rgb);
+};
+
+const char* isa_name(Isa isa);
+Isa parse_isa(const std::string& name);
+
+bool isa_supported(Isa isa);
+std::vector<Isa> supported_isas();
+Isa best_isa();
+
+// Selects the kernel variants used by every following call. "auto" picks the
+// best ISA the CPU supports; an explicit name must be supported.
+Isa select_isa(const std::string& name);
+void select_isa(Isa isa);
+Isa active_isa();
+
+const KernelTable& active_kernels();
+
+template <Formula F = Formula::mandelbrot, typename T>
+void escape_iterations(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, std::uint64_t* iters, T* zr, T* zi, T* peaks)
+{
+    constexpr std::size_t f = static_cast<std::size_t>(F);
+    if constexpr (std::is_same_v<T, float>) {
+        active_kernels().escape_iterations_f32[f](cr, ci, n, max_iter, bailout, iters, zr, zi, peaks);
+    } else if constexpr (std::is_same_v<T, double>) {
+        active_kernels().escape_iterations_f64[f](cr, ci, n, max_iter, bailout, iters, zr, zi, peaks);
+    } else if constexpr (std::is_same_v<T, DoubleDouble>) {
+        active_kernels().escape_iterations_dd[f](cr, ci, n, max_iter, bailout, iters, zr, zi, peaks);
+    } else {
+        kernels::escape_iterations<F>(cr, ci, n, max_iter, bailout, iters, zr, zi, peaks);
+    }
+}
+
+template <Formula F = Formula::mandelbrot, typename T>
+void escape_viewport(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, const kernels::PixelMap<T>& map, std::uint64_t* iters, T* zr, T* zi, std::uint8_t* entered)
+{
+    constexpr std::size_t f = static_cast<std::size_t>(F);
+    if constexpr (std::is_same_v<T, float>) {
+        active_kernels().escape_viewport_f32[f](cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered);
+    } else if constexpr (std::is_same_v<T, double>) {
+        active_kernels().escape_viewport_f64[f](cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered);
+    } else if constexpr (std::is_same_v<T, DoubleDouble>) {
+        active_kernels().escape_viewport_dd[f](cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered);
+    } else {
+        kernels::escape_viewport<F>(cr, ci, n, max_iter, bailout, map, iters, zr, zi, entered);
+    }
+}
+
+template <typename T>
+std::size_t orbit_pixels(const T* re, const T* im, std::size_t n, const kernels::PixelMap<T>& map, std::uint64_t* indices)
+{
+    if constexpr (std::is_same_v<T, float>) {
+        return active_kernels().orbit_pixels_f32(re, im, n, map, indices);
+    } else if constexpr (std::is_same_v<T, double>) {
+        return active_kernels().orbit_pixels_f64(re, im, n, map, indices);
+    } else if constexpr (std::is_same_v<T, DoubleDouble>) {
+        return active_kernels().orbit_pixels_dd(re, im, n, map, indices);
+    } else {
+        return kernels::orbit_pixels(re, im, n, map, indices);
+    }
+}
+
+// orbit_pixels for a square 2^SizeLog2 output, whatever map's size says.
+template <std::uint32_t SizeLog2, typename T>
+std::size_t orbit_pixels_pow2(const T* re, const T* im, std::size_t n, const kernels::PixelMap<T>& map, std::uint64_t* indices)
+{
+    static_assert(SizeLog2 >= pow2_log2_min && SizeLog2 <= pow2_log2_max, "No orbit_pixels variant for this size");
+    constexpr std::size_t s = SizeLog2 - pow2_log2_min;
+    if constexpr (std::is_same_v<T, float>) {
+        return active_kernels().orbit_pixels_pow2_f32[s](re, im, n, map, indices);
+    } else if constexpr (std::is_same_v<T, double>) {
+        return active_kernels().orbit_pixels_pow2_f64[s](re, im, n, map, indices);
+    } else if constexpr (std::is_same_v<T, DoubleDouble>) {
+        return active_kernels().orbit_pixels_pow2_dd[s](re, im, n, map, indices);
+    } else {
+        kernels::PixelMap<T> fixed = map;
+        fixed.width = std::uint64_t { 1 } << SizeLog2;
+        fixed.height = std::uint64_t { 1 } << SizeLog2;
+        return kernels::orbit_pixels(re, im, n, fixed, indices);
+    }
+}
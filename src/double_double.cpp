@@ -0,0 +1,85 @@
+#include <cctype>
+#include <cstddef>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+#include "double_double.h"
+
+namespace {
+
+DoubleDouble power_of_ten(int n)
+{
+    DoubleDouble result = 1.0;
+    DoubleDouble base = 10.0;
+    for (; n > 0; n /= 2) {
+        if (n & 1) {
+            result = result * base;
+        }
+        base = base * base;
+    }
+
+    return result;
+}
+
+}
+
+DoubleDouble parse_double_double(const std::string& s)
+{
+    std::size_t pos = 0;
+    bool negative = false;
+    if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+        negative = s[pos++] == '-';
+    }
+
+    DoubleDouble mantissa = 0.0;
+    int exponent = 0;
+    bool any_digit = false;
+    bool after_point = false;
+    for (; pos < s.size(); ++pos) {
+        char c = s[pos];
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            mantissa = mantissa * 10.0 + static_cast<double>(c - '0');
+            exponent -= after_point;
+            any_digit = true;
+        } else if (c == '.' && !after_point) {
+            after_point = true;
+        } else {
+            break;
+        }
+    }
+    if (!any_digit) {
+        throw std::invalid_argument("Invalid number '" + s + "'");
+    }
+
+    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+        std::size_t n_parsed = 0;
+        try {
+            exponent += std::stoi(s.substr(pos + 1), &n_parsed);
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Invalid number '" + s + "'");
+        }
+        pos += 1 + n_parsed;
+    }
+    if (pos != s.size()) {
+        throw std::invalid_argument("Invalid number '" + s + "'");
+    }
+
+    DoubleDouble value = exponent >= 0 ? mantissa * power_of_ten(exponent) : mantissa / power_of_ten(-exponent);
+    return negative ? -value : value;
+}
+
+std::istream& operator>>(std::istream& is, DoubleDouble& value)
+{
+    std::string token;
+    if (!(is >> token)) {
+        return is;
+    }
+
+    try {
+        value = parse_double_double(token);
+    } catch (const std::invalid_argument&) {
+        is.setstate(std::ios::failbit);
+    }
+    return is;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+#include "kernels.h"
+
+namespace dd {
+
+// Whether the whole build targets FMA. Kernels compiled for an FMA target of
+// their own ask for it through the template parameter instead, since the
+// preprocessor only sees the flags of the translation unit.
+#if defined(__FMA__)
+constexpr bool native_fma = true;
+#else
+constexpr bool native_fma = false;
+#endif
+
+}
+
+// Unevaluated sum hi + lo of two doubles with |lo| <= ulp(hi) / 2, good for
+// about 106 bits of significand with the exponent range of double. All
+// operations are branch free double arithmetic, so the lane kernels vectorize
+// over it like over double. Comparisons and the conversion to double look at
+// hi first, so escape tests agree with double wherever double resolves them.
+//
+// Fma picks how products get their error term. Both ways give the exact
+// term, so the flavours compute bit-identical results and only differ in
+// speed; DoubleDouble is the one matching the build flags.
+template <bool Fma>
+struct BasicDoubleDouble {
+    double hi = 0.0;
+    double lo = 0.0;
+
+    constexpr BasicDoubleDouble() = default;
+
+    constexpr BasicDoubleDouble(double hi)
+        : hi(hi)
+    {
+    }
+
+    constexpr BasicDoubleDouble(double hi, double lo)
+        : hi(hi)
+        , lo(lo)
+    {
+    }
+
+    template <bool OtherFma>
+    explicit constexpr BasicDoubleDouble(BasicDoubleDouble<OtherFma> v)
+        : hi(v.hi)
+        , lo(v.lo)
+    {
+    }
+
+    explicit constexpr operator double() const
+    {
+        return hi;
+    }
+
+    explicit constexpr operator float() const
+    {
+        return static_cast<float>(hi);
+    }
+
+    // s + e == a + b exactly.
+    KERNEL_INLINE static BasicDoubleDouble two_sum(double a, double b)
+    {
+        double s = a + b;
+        double bb = s - a;
+        double e = (a - (s - bb)) + (b - bb);
+        return { s, e };
+    }
+
+    // Like two_sum, for |a| >= |b|.
+    KERNEL_INLINE static BasicDoubleDouble quick_two_sum(double a, double b)
+    {
+        double s = a + b;
+        double e = b - (s - a);
+        return { s, e };
+    }
+
+    // p + e == a * b exactly. Without FMA, Dekker's splitting gives the same
+    // error term, which relies on the build not contracting to FMA.
+    KERNEL_INLINE static BasicDoubleDouble two_prod(double a, double b)
+    {
+        double p = a * b;
+        if constexpr (Fma) {
+            return { p, std::fma(a, b, -p) };
+        } else {
+            constexpr double splitter = 134217729.0; // 2^27 + 1
+            double ta = splitter * a;
+            double a_hi = ta - (ta - a);
+            double a_lo = a - a_hi;
+            double tb = splitter * b;
+            double b_hi = tb - (tb - b);
+            double b_lo = b - b_hi;
+            return { p, ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo };
+        }
+    }
+
+    // The operators are hidden friends, so they are found for either flavour
+    // and still convert double operands implicitly.
+    KERNEL_INLINE friend BasicDoubleDouble operator-(BasicDoubleDouble a)
+    {
+        return { -a.hi, -a.lo };
+    }
+
+    KERNEL_INLINE friend BasicDoubleDouble operator+(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        BasicDoubleDouble s = two_sum(a.hi, b.hi);
+        BasicDoubleDouble t = two_sum(a.lo, b.lo);
+        s = quick_two_sum(s.hi, s.lo + t.hi);
+        return quick_two_sum(s.hi, s.lo + t.lo);
+    }
+
+    KERNEL_INLINE friend BasicDoubleDouble operator-(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return a + -b;
+    }
+
+    KERNEL_INLINE friend BasicDoubleDouble operator*(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        BasicDoubleDouble p = two_prod(a.hi, b.hi);
+        return quick_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+    }
+
+    KERNEL_INLINE friend BasicDoubleDouble operator/(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        double q1 = a.hi / b.hi;
+        BasicDoubleDouble r = a - b * q1;
+        double q2 = r.hi / b.hi;
+        r = r - b * q2;
+        double q3 = r.hi / b.hi;
+        return quick_two_sum(q1, q2) + q3;
+    }
+
+    KERNEL_INLINE friend bool operator==(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return (a.hi == b.hi) & (a.lo == b.lo);
+    }
+
+    KERNEL_INLINE friend bool operator<(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return (a.hi < b.hi) | ((a.hi == b.hi) & (a.lo < b.lo));
+    }
+
+    KERNEL_INLINE friend bool operator>(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return b < a;
+    }
+
+    // Spelled out rather than negated, so NaN compares false like in double.
+    KERNEL_INLINE friend bool operator<=(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return (a.hi < b.hi) | ((a.hi == b.hi) & (a.lo <= b.lo));
+    }
+
+    KERNEL_INLINE friend bool operator>=(BasicDoubleDouble a, BasicDoubleDouble b)
+    {
+        return b <= a;
+    }
+
+    // abs and lerp are found by argument dependent lookup from generic code
+    // that calls them unqualified after using the std versions.
+    KERNEL_INLINE friend BasicDoubleDouble abs(BasicDoubleDouble a)
+    {
+        std::uint64_t negative = -static_cast<std::uint64_t>(a.hi < 0.0);
+        return { kernels::select(negative, -a.hi, a.hi), kernels::select(negative, -a.lo, a.lo) };
+    }
+
+    friend BasicDoubleDouble lerp(BasicDoubleDouble a, BasicDoubleDouble b, BasicDoubleDouble t)
+    {
+        return a + t * (b - a);
+    }
+};
+
+using DoubleDouble = BasicDoubleDouble<dd::native_fma>;
+
+template <bool Fma>
+struct kernels::LaneArray<BasicDoubleDouble<Fma>> {
+    double hi[lanes];
+    double lo[lanes];
+
+    KERNEL_INLINE BasicDoubleDouble<Fma> get(std::size_t l) const
+    {
+        return { hi[l], lo[l] };
+    }
+
+    KERNEL_INLINE void set(std::size_t l, BasicDoubleDouble<Fma> v)
+    {
+        hi[l] = v.hi;
+        lo[l] = v.lo;
+    }
+
+    KERNEL_INLINE void select(std::size_t l, std::uint64_t mask, BasicDoubleDouble<Fma> v)
+    {
+        hi[l] = kernels::select(mask, v.hi, hi[l]);
+        lo[l] = kernels::select(mask, v.lo, lo[l]);
+    }
+};
+
+// Decimal parsing to full double-double precision, so deep-zoom viewports
+// can be given beyond the 17 significant digits of double.
+DoubleDouble parse_double_double(const std::string& s);
+std::istream& operator>>(std::istream& is, DoubleDouble& value);
@@ -0,0 +1,35 @@
+#include <array>
+#include <stdexcept>
+#include <string>
+
+#include "formula.h"
+
+namespace {
+
+const std::array<const char*, n_formulas> formula_names {
+    "mandelbrot",
+    "multibrot3",
+    "multibrot4",
+    "multibrot5",
+    "multibrot6",
+    "tricorn",
+    "burning-ship",
+};
+
+}
+
+const char* formula_name(Formula formula)
+{
+    return formula_names[static_cast<std::size_t>(formula)];
+}
+
+Formula parse_formula(const std::string& name)
+{
+    for (std::size_t i = 0; i < n_formulas; ++i) {
+        if (name == formula_names[i]) {
+            return static_cast<Formula>(i);
+        }
+    }
+
+    throw std::invalid_argument("Invalid formula " + name);
+}
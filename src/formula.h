@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+// Iteration z -> f(z) + c of the fractal being sampled. Every formula keeps
+// |f(z)| = |z|^d, so the bailout radius of 2 and the seed mask over
+// [-2, 2]^2 hold for all of them.
+enum class Formula {
+    mandelbrot,
+    multibrot3,
+    multibrot4,
+    multibrot5,
+    multibrot6,
+    tricorn,
+    burning_ship,
+};
+
+constexpr std::size_t n_formulas = 7;
+
+const char* formula_name(Formula formula);
+Formula parse_formula(const std::string& name);
+
+// Degree d of the z^d term.
+constexpr unsigned formula_power(Formula formula)
+{
+    switch (formula) {
+    case Formula::multibrot3:
+        return 3;
+    case Formula::multibrot4:
+        return 4;
+    case Formula::multibrot5:
+        return 5;
+    case Formula::multibrot6:
+        return 6;
+    default:
+        return 2;
+    }
+}
+
+// True when the orbit of conj(c) is the conjugate of the orbit of c, so that
+// every orbit point can also be splatted mirrored. Burning Ship folds z into
+// the first quadrant before squaring, which breaks this.
+constexpr bool conjugate_symmetric(Formula formula)
+{
+    return formula != Formula::burning_ship;
+}
+
+// Calls fn with std::integral_constant<Formula, F> for the runtime formula,
+// to pick a compile-time instantiation.
+template <typename Fn>
+decltype(auto) with_formula(Formula formula, Fn&& fn)
+{
+    switch (formula) {
+    case Formula::multibrot3:
+        return fn(std::integral_constant<Formula, Formula::multibrot3> {});
+    case Formula::multibrot4:
+        return fn(std::integral_constant<Formula, Formula::multibrot4> {});
+    case Formula::multibrot5:
+        return fn(std::integral_constant<Formula, Formula::multibrot5> {});
+    case Formula::multibrot6:
+        return fn(std::integral_constant<Formula, Formula::multibrot6> {});
+    case Formula::tricorn:
+        return fn(std::integral_constant<Formula, Formula::tricorn> {});
+    case Formula::burning_ship:
+        return fn(std::integral_constant<Formula, Formula::burning_ship> {});
+    default:
+        return fn(std::integral_constant<Formula, Formula::mandelbrot> {});
+    }
+}
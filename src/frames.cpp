@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "frames.h"
+
+std::vector<std::uint64_t> band_edges(const std::vector<IterWindow>& windows)
+{
+    std::vector<std::uint64_t> edges;
+    for (auto [first, second] : windows) {
+        edges.push_back(first);
+        edges.push_back(second + 1);
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    return edges;
+}
+
+void accumulate_bands(std::vector<std::uint64_t>& counts, std::size_t n_pixels)
+{
+    for (std::size_t offset = n_pixels; offset < counts.size(); offset += n_pixels) {
+        std::transform(counts.begin() + offset, counts.begin() + offset + n_pixels, counts.begin() + offset - n_pixels, counts.begin() + offset, std::plus<>());
+    }
+}
+
+std::vector<std::uint64_t> window_counts(const std::vector<std::uint64_t>& cumulative, const std::vector<std::uint64_t>& edges, const IterWindow& window, std::size_t n_pixels)
+{
+    std::size_t first = std::lower_bound(edges.begin(), edges.end(), window.first) - edges.begin();
+    std::size_t last = std::lower_bound(edges.begin(), edges.end(), window.second + 1) - edges.begin() - 1;
+
+    auto upper = cumulative.begin() + last * n_pixels;
+    std::vector<std::uint64_t> result(upper, upper + n_pixels);
+    if (first > 0) {
+        auto lower = cumulative.begin() + (first - 1) * n_pixels;
+        std::transform(result.begin(), result.end(), lower, result.begin(), std::minus<>());
+    }
+
+    return result;
+}
+
+std::vector<IterWindow> sweep_windows(bool lower_end, std::uint64_t from, std::uint64_t to, std::size_t n_frames, std::uint64_t fixed)
+{
+    std::vector<IterWindow> windows;
+    for (std::size_t k = 0; k < n_frames; ++k) {
+        double t = n_frames > 1 ? static_cast<double>(k) / (n_frames - 1) : 0.0;
+        auto end = static_cast<std::uint64_t>(std::llround(from + t * (static_cast<double>(to) - from)));
+        windows.push_back(lower_end ? IterWindow { end, fixed } : IterWindow { fixed, end });
+    }
+
+    return windows;
+}
+
+std::string frame_filename(const std::string& output, std::size_t frame)
+{
+    std::size_t dot = output.rfind('.');
+    std::size_t slash = output.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = output.size();
+    }
+
+    std::ostringstream oss;
+    oss << output.substr(0, dot) << "_" << std::setfill('0') << std::setw(4) << frame << output.substr(dot);
+    return oss.str();
+}
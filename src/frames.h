@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Orbit lengths first <= n <= second that a frame or Nebulabrot channel
+// collects.
+using IterWindow = std::pair<std::uint64_t, std::uint64_t>;
+
+// Splits the orbit lengths at every window's first and second + 1. Elementary
+// band b holds lengths in [edges[b], edges[b + 1]), so each escaping orbit
+// lands in at most one band and each window is a run of consecutive bands.
+std::vector<std::uint64_t> band_edges(const std::vector<IterWindow>& windows);
+
+// Replaces band histograms stored one after the other by their running sums
+// over the bands, in place.
+void accumulate_bands(std::vector<std::uint64_t>& counts, std::size_t n_pixels);
+
+// Histogram of one window from accumulated bands: a single band for windows
+// starting at the first edge, the difference of two otherwise.
+std::vector<std::uint64_t> window_counts(const std::vector<std::uint64_t>& cumulative, const std::vector<std::uint64_t>& edges, const IterWindow& window, std::size_t n_pixels);
+
+// n_frames windows whose lower (lower_end) or upper end steps evenly from
+// from to to, with the other end fixed at fixed.
+std::vector<IterWindow> sweep_windows(bool lower_end, std::uint64_t from, std::uint64_t to, std::size_t n_frames, std::uint64_t fixed);
+
+// "out.ppm" becomes "out_0007.ppm" for frame 7.
+std::string frame_filename(const std::string& output, std::size_t frame);
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cmap.h"
+#include "dispatch.h"
+#include "formula.h"
+#include "frames.h"
+#include "golden.h"
+#include "image.h"
+#include "render.h"
+
+namespace {
+
+std::vector<std::uint64_t> to_counts(const Mask& mask)
+{
+    return std::vector<std::uint64_t>(mask.begin(), mask.end());
+}
+
+std::vector<std::uint64_t> run_sampler(RenderConfig config, const std::string& precision, bool prefilter = false, bool specialize = true)
+{
+    config.precision = precision;
+    config.prefilter = prefilter;
+    config.specialize = specialize;
+    auto good_points = find_good_points(config.size, config.seed_max_iter, config.n_dilations, false, parse_formula(config.formula));
+
+    RenderStats stats;
+    return sample_buddhabrot(config, good_points, stats);
+}
+
+// The histogram assembled from out-of-core passes over strips of strip_rows
+// rows.
+std::vector<std::uint64_t> run_strips(RenderConfig config, std::uint64_t strip_rows)
+{
+    auto good_points = find_good_points(config.size, config.seed_max_iter, config.n_dilations, false);
+
+    std::vector<std::uint64_t> result;
+    for (std::uint64_t row = 0; row < config.size; row += strip_rows) {
+        RenderStats stats;
+        std::vector<std::uint64_t> strip = sample_buddhabrot(config, good_points, stats, nullptr, { row, std::min(config.size, row + strip_rows) });
+        result.insert(result.end(), strip.begin(), strip.end());
+    }
+
+    return result;
+}
+
+// The histogram of one window of a banded render, config.bands or a sweep
+// being set.
+std::vector<std::uint64_t> run_window(const RenderConfig& config, IterWindow window)
+{
+    auto good_points = find_good_points(config.size, config.seed_max_iter, config.n_dilations, false);
+
+    RenderStats stats;
+    std::vector<std::uint64_t> counts = sample_buddhabrot(config, good_points, stats);
+    std::uint64_t n_pixels = config.size * config.size;
+    accumulate_bands(counts, n_pixels);
+
+    return window_counts(counts, band_edges(iter_windows(config)), window, n_pixels);
+}
+
+// The anti-Buddhabrot and target histograms sampled next to the main one.
+SampleOutputs run_outputs(const RenderConfig& config)
+{
+    auto good_points = find_good_points(config.size, config.seed_max_iter, config.n_dilations, false);
+
+    RenderStats stats;
+    SampleOutputs outputs;
+    sample_buddhabrot(config, good_points, stats, &outputs);
+
+    return outputs;
+}
+
+// Records the escaping seeds of a render and replays them.
+std::vector<std::uint64_t> run_replay(RenderConfig config)
+{
+    std::random_device rd;
+    std::string path = (std::filesystem::temp_directory_path() / ("buddhabrot-golden-" + std::to_string(rd()) + ".seeds")).string();
+
+    config.record_seeds = path;
+    run_sampler(config, "double");
+    config.record_seeds.clear();
+    config.replay_seeds = path;
+    std::vector<std::uint64_t> result;
+    try {
+        result = run_sampler(config, "double");
+    } catch (...) {
+        std::filesystem::remove(path);
+        throw;
+    }
+    std::filesystem::remove(path);
+
+    return result;
+}
+
+// Views the golden viewport and target variants render.
+RenderConfig with_golden_viewport(RenderConfig config)
+{
+    config.re_min = -1.5;
+    config.re_max = 0.5;
+    config.im_min = -1.0;
+    config.im_max = 1.0;
+
+    return config;
+}
+
+// 1 for every pixel of a hitless target's image that has the colormap's
+// lowest colour, 0 for any other.
+std::vector<std::uint64_t> run_empty_target(RenderConfig config)
+{
+    config.targets.push_back({ 100.0, 101.0, 100.0, 101.0, config.size, config.size, "empty.ppm" });
+    std::vector<std::uint8_t> rgb = tone_map_image(run_outputs(config).targets.front(), config.size, config.cmap);
+
+    const auto& lowest = Colormap<float>::by_name(config.cmap).table().front();
+    std::vector<std::uint64_t> result(config.size * config.size);
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        bool match = true;
+        for (std::size_t ch = 0; ch < 3; ++ch) {
+            match &= rgb[3 * i + ch] == static_cast<std::uint8_t>(std::min(255, static_cast<int>(256 * lowest[ch])));
+        }
+        result[i] = match;
+    }
+
+    return result;
+}
+
+std::string golden_path(const std::string& dir, const std::string& golden)
+{
+    return dir + "/" + golden + ".hist";
+}
+
+std::uint64_t golden_max_iter(const RenderConfig& config, const std::string& golden)
+{
+    return golden == "binary_mandelbrot" || golden.ends_with("mask") ? config.seed_max_iter : config.max_iter;
+}
+
+void write_diff_image(const std::string& filename, const std::vector<std::uint64_t>& expected, const std::vector<std::uint64_t>& actual, std::uint64_t size)
+{
+    double expected_total = std::max<double>(1.0, std::accumulate(expected.begin(), expected.end(), 0.0));
+    double actual_total = std::max<double>(1.0, std::accumulate(actual.begin(), actual.end(), 0.0));
+
+    std::vector<double> diff(expected.size());
+    double max_diff = 0.0;
+    for (std::size_t i = 0; i < diff.size(); ++i) {
+        diff[i] = actual[i] / actual_total - expected[i] / expected_total;
+        max_diff = std::max(max_diff, std::abs(diff[i]));
+    }
+    std::vector<float> background = log_image(expected);
+    float vmax = std::max(1e-6f, *std::max_element(background.begin(), background.end()));
+
+    // Gray is the expected image, red marks pixels the variant undercounts
+    // and green pixels it overcounts.
+    std::ofstream ofs(filename);
+    ofs << "P3\n" << size << " " << size << "\n255\n";
+    for (std::size_t i = 0; i < diff.size(); ++i) {
+        int gray = static_cast<int>(96 * background[i] / vmax);
+        int delta = max_diff > 0.0 ? static_cast<int>(255 * std::abs(diff[i]) / max_diff) : 0;
+        int r = diff[i] < 0.0 ? std::max(gray, delta) : gray;
+        int g = diff[i] > 0.0 ? std::max(gray, delta) : gray;
+        ofs << r << " " << g << " " << gray << " ";
+    }
+}
+
+}
+
+RenderConfig golden_config()
+{
+    RenderConfig config;
+    config.size = 64;
+    config.max_iter = 100;
+    config.seed_max_iter = 100;
+    config.n_dilations = 2;
+    config.n_threads = 1;
+    config.points_per_thread = 200000;
+    config.p_uniform = 0.5f;
+    config.seed = 1;
+    config.quiet = true;
+
+    return config;
+}
+
+std::vector<GoldenVariant> golden_variants()
+{
+    std::vector<GoldenVariant> kernels {
+        { "binary_mandelbrot", "binary_mandelbrot", true,
+            [](const RenderConfig& config) { return to_counts(binary_mandelbrot(config.size, config.seed_max_iter)); } },
+        { "seed_mask", "seed_mask", true,
+            [](const RenderConfig& config) { return to_counts(seed_mask(config.size, config.seed_max_iter, config.n_dilations, false)); } },
+        { "burning_ship_mask", "burning_ship_mask", true,
+            [](const RenderConfig& config) { return to_counts(binary_mandelbrot(config.size, config.seed_max_iter, Formula::burning_ship)); } },
+        { "histogram/double", "histogram", true,
+            [](const RenderConfig& config) { return run_sampler(config, "double"); } },
+        { "histogram/generic", "histogram", true,
+            [](const RenderConfig& config) { return run_sampler(config, "double", false, false); } },
+        { "histogram/recompute", "histogram", true,
+            [](RenderConfig config) {
+                config.orbit_mode = "recompute";
+                return run_sampler(config, "double");
+            } },
+        { "histogram/pipeline", "histogram", true,
+            [](RenderConfig config) {
+                config.n_splatters = 2;
+                config.ring_capacity = 64;
+                return run_sampler(config, "double");
+            } },
+        { "histogram/strips", "histogram", true,
+            [](const RenderConfig& config) { return run_strips(config, 24); } },
+        { "histogram/float", "histogram", false,
+            [](const RenderConfig& config) { return run_sampler(config, "float"); } },
+        { "histogram/prefilter", "histogram", false,
+            [](const RenderConfig& config) { return run_sampler(config, "double", true); } },
+        { "histogram/double-double", "histogram", false,
+            [](const RenderConfig& config) { return run_sampler(config, "double-double"); } },
+        { "histogram/replay", "histogram", false,
+            [](const RenderConfig& config) { return run_replay(config); } },
+        // The channel of a Nebulabrot band and the frame of a sweep that
+        // cover orbit lengths up to max_iter are the plain histogram.
+        { "histogram/nebula-band", "histogram", true,
+            [](RenderConfig config) {
+                config.bands = { { 0, 10 }, { 11, 50 }, { 51, config.max_iter } };
+                return run_window(config, { 0, config.max_iter });
+            } },
+        { "histogram/sweep-frame", "histogram", true,
+            [](RenderConfig config) {
+                config.sweep = { false, config.max_iter / 2, config.max_iter, 2 };
+                return run_window(config, { 0, config.max_iter });
+            } },
+        { "anti", "anti", true,
+            [](RenderConfig config) {
+                config.anti_output = "anti.ppm";
+                return run_outputs(config).anti;
+            } },
+        // A target splatted from the main orbits matches a render of its
+        // viewport.
+        { "viewport/direct", "viewport", true,
+            [](const RenderConfig& config) { return run_sampler(with_golden_viewport(config), "double"); } },
+        { "viewport/target", "viewport", true,
+            [](RenderConfig config) {
+                RenderConfig view = with_golden_viewport(config);
+                config.targets.push_back({ view.re_min, view.re_max, view.im_min, view.im_max, config.size, config.size, "target.ppm" });
+                return run_outputs(config).targets.front();
+            } },
+        // Histograms of other formulas, seeded from their own masks. The
+        // recompute variants run the per-ISA escape kernel on every sample.
+        { "multibrot5/histogram", "multibrot5", true,
+            [](RenderConfig config) {
+                config.formula = "multibrot5";
+                return run_sampler(config, "double");
+            } },
+        { "multibrot5/recompute", "multibrot5", true,
+            [](RenderConfig config) {
+                config.formula = "multibrot5";
+                config.orbit_mode = "recompute";
+                return run_sampler(config, "double");
+            } },
+        { "tricorn/histogram", "tricorn", true,
+            [](RenderConfig config) {
+                config.formula = "tricorn";
+                return run_sampler(config, "double");
+            } },
+        { "tricorn/recompute", "tricorn", true,
+            [](RenderConfig config) {
+                config.formula = "tricorn";
+                config.orbit_mode = "recompute";
+                return run_sampler(config, "double");
+            } },
+        // A target without hits maps every pixel to the lowest colour.
+        { "empty_target", "empty_target", true,
+            [](const RenderConfig& config) { return run_empty_target(config); } },
+    };
+
+    // Every kernel runs once per supported ISA. The first variant of each
+    // golden (the baseline ISA) is the reference golden_write stores.
+    std::vector<GoldenVariant> variants;
+    for (Isa isa : supported_isas()) {
+        for (const auto& kernel : kernels) {
+            variants.push_back({ kernel.name + "/" + isa_name(isa), kernel.golden, kernel.exact,
+                [isa, run = kernel.run](const RenderConfig& config) {
+                    Isa previous = active_isa();
+                    select_isa(isa);
+                    auto result = run(config);
+                    select_isa(previous);
+                    return result;
+                } });
+        }
+    }
+
+    return variants;
+}
+
+// Total variation distance between the normalized histograms after summing
+// them over block x block tiles, in [0, 1].
+double block_distance(const std::vector<std::uint64_t>& a, const std::vector<std::uint64_t>& b, std::uint64_t size, std::uint64_t block)
+{
+    std::uint64_t n_blocks = (size + block - 1) / block;
+    std::vector<double> a_blocks(n_blocks * n_blocks);
+    std::vector<double> b_blocks(n_blocks * n_blocks);
+    for (std::uint64_t y = 0; y < size; ++y) {
+        for (std::uint64_t x = 0; x < size; ++x) {
+            a_blocks[(y / block) * n_blocks + x / block] += a[y * size + x];
+            b_blocks[(y / block) * n_blocks + x / block] += b[y * size + x];
+        }
+    }
+
+    double a_total = std::max(1.0, std::accumulate(a_blocks.begin(), a_blocks.end(), 0.0));
+    double b_total = std::max(1.0, std::accumulate(b_blocks.begin(), b_blocks.end(), 0.0));
+    double distance = 0.0;
+    for (std::size_t i = 0; i < a_blocks.size(); ++i) {
+        distance += std::abs(a_blocks[i] / a_total - b_blocks[i] / b_total);
+    }
+
+    return distance / 2.0;
+}
+
+void golden_write(const std::string& dir)
+{
+    RenderConfig config = golden_config();
+    std::filesystem::create_directories(dir);
+
+    std::set<std::string> written;
+    for (const auto& variant : golden_variants()) {
+        if (!written.insert(variant.golden).second) {
+            continue;
+        }
+
+        std::string path = golden_path(dir, variant.golden);
+        write_histogram(path, variant.run(config), config.size, config.size, golden_max_iter(config, variant.golden), 0);
+        std::cout << "Wrote " << path << " from " << variant.name << "\n";
+    }
+}
+
+bool golden_check(const std::string& dir, double tolerance)
+{
+    RenderConfig config = golden_config();
+    bool all_passed = true;
+
+    for (const auto& variant : golden_variants()) {
+        std::uint64_t n_samples = 0;
+        std::string path = golden_path(dir, variant.golden);
+        std::vector<std::uint64_t> expected = read_histogram(path, config.size, config.size, golden_max_iter(config, variant.golden), n_samples);
+        std::vector<std::uint64_t> actual = variant.run(config);
+
+        bool passed;
+        std::cout << std::setfill(' ') << std::left << std::setw(32) << variant.name << std::right;
+        if (variant.exact) {
+            auto mismatches = std::inner_product(expected.begin(), expected.end(), actual.begin(), std::size_t { 0 },
+                std::plus<>(), [](std::uint64_t e, std::uint64_t a) { return e != a; });
+            passed = mismatches == 0;
+            std::cout << "exact       " << mismatches << " mismatched pixels";
+        } else {
+            double distance = block_distance(expected, actual, config.size, 4);
+            passed = distance <= tolerance;
+            std::cout << "statistical " << std::fixed << std::setprecision(4) << distance << " <= " << tolerance;
+        }
+
+        if (passed) {
+            std::cout << "  ok\n";
+        } else {
+            std::string name = variant.name;
+            std::replace(name.begin(), name.end(), '/', '_');
+            std::string diff_path = dir + "/" + name + ".diff.ppm";
+            write_diff_image(diff_path, expected, actual, config.size);
+            std::cout << "  FAILED, diff in " << diff_path << "\n";
+            all_passed = false;
+        }
+    }
+
+    return all_passed;
+}
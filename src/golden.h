@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "render.h"
+
+struct GoldenVariant {
+    std::string name;
+    std::string golden;
+    bool exact;
+    std::function<std::vector<std::uint64_t>(const RenderConfig&)> run;
+};
+
+RenderConfig golden_config();
+std::vector<GoldenVariant> golden_variants();
+
+double block_distance(const std::vector<std::uint64_t>& a, const std::vector<std::uint64_t>& b, std::uint64_t size, std::uint64_t block);
+
+void golden_write(const std::string& dir);
+bool golden_check(const std::string& dir, double tolerance);
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dispatch.h"
+#include "formula.h"
+#include "image.h"
+#include "pool.h"
+
+namespace {
+
+bool is_cancelled(const std::atomic<bool>* cancelled)
+{
+    return cancelled != nullptr && *cancelled;
+}
+
+// The engine after n draws from its default state, in O(log n) steps. The
+// default engine is a multiplicative LCG, so n draws multiply its state by
+// multiplier^n modulo modulus.
+std::default_random_engine engine_after(std::uint64_t n)
+{
+    using Engine = std::default_random_engine;
+    static_assert(Engine::increment == 0, "engine_after expects a multiplicative LCG");
+    static_assert(Engine::modulus <= std::uint64_t { 1 } << 32, "engine_after multiplies states in 64 bits");
+
+    std::uint64_t state = Engine::default_seed % Engine::modulus;
+    std::uint64_t factor = Engine::multiplier;
+    for (; n > 0; n >>= 1) {
+        if (n & 1) {
+            state = state * factor % Engine::modulus;
+        }
+        factor = factor * factor % Engine::modulus;
+    }
+
+    return Engine(state);
+}
+
+}
+
+Mask binary_mandelbrot(std::uint64_t size, std::uint64_t max_iter, Formula formula, const std::atomic<bool>* cancelled)
+{
+    Mask result(size * size);
+
+    float delta = 4.0f / size;
+    std::uniform_real_distribution offset(-0.25f * delta, 0.25f * delta);
+
+    // Rows are rendered in parallel chunks, each jumping its engine to the
+    // state a sequential pass would have reached, so the mask doesn't
+    // depend on the pool size. Every offset takes one draw, two per pixel.
+    std::uint64_t grain = 16;
+    parallel_for(0, size, grain, [&](std::uint64_t begin, std::uint64_t end) {
+        if (is_cancelled(cancelled)) {
+            return;
+        }
+        std::default_random_engine eng = engine_after(2 * begin * size);
+        std::vector<float> cr(size);
+        std::vector<float> ci(size);
+        std::vector<std::uint64_t> iters(size);
+        std::vector<float> zr(size);
+        std::vector<float> zi(size);
+        std::vector<float> peaks(size);
+
+        for (std::uint64_t y = begin; y < end; ++y) {
+            float im = std::lerp(-2.0f, 2.0f, static_cast<float>(y) / size);
+            for (std::uint64_t x = 0; x < size; ++x) {
+                float re = std::lerp(-2.0f, 2.0f, static_cast<float>(x) / size);
+                cr[x] = re + offset(eng);
+                ci[x] = im + offset(eng);
+            }
+
+            with_formula(formula, [&](auto f) {
+                escape_iterations<decltype(f)::value>(cr.data(), ci.data(), size, max_iter, 4.0f, iters.data(), zr.data(), zi.data(), peaks.data());
+            });
+
+            for (std::uint64_t x = 0; x < size; ++x) {
+                result[y * size + x] = zr[x] * zr[x] + zi[x] * zi[x] < 4.0f;
+            }
+        }
+    });
+
+    return result;
+}
+
+namespace {
+
+// Mask pixels per parallel_for chunk.
+constexpr std::size_t mask_grain = 1 << 16;
+
+// Applies a 4-neighbour kernel to the rows with all neighbours in bounds and
+// the bounds-checked fallback to the first and last row.
+template <typename Fallback>
+void neighbourhood_op(const Mask& im, Mask& result, std::int64_t size, void (*kernel)(const std::uint8_t*, std::uint8_t*, std::int64_t, std::int64_t, std::int64_t), Fallback fallback)
+{
+    std::int64_t n = im.size();
+    std::int64_t inner_begin = std::min(size, n);
+    std::int64_t inner_end = std::max(inner_begin, n - size);
+
+    for (std::int64_t i = 0; i < inner_begin; ++i) {
+        result[i] = fallback(i);
+    }
+    parallel_for(inner_begin, inner_end, mask_grain, [&](std::size_t begin, std::size_t end) {
+        kernel(im.data(), result.data(), begin, end, size);
+    });
+    for (std::int64_t i = inner_end; i < n; ++i) {
+        result[i] = fallback(i);
+    }
+}
+
+}
+
+Mask im_edge(const Mask& im, std::int64_t size)
+{
+    Mask result(im.size());
+
+    std::vector<std::int64_t> deltas { -size, -1, 1, size };
+    auto in_bounds = [&](std::int64_t idx) { return idx >= 0 && idx < static_cast<std::int64_t>(im.size()); };
+
+    neighbourhood_op(im, result, size, active_kernels().edge, [&](std::int64_t i) {
+        return im[i] && std::any_of(deltas.begin(), deltas.end(), [&](std::int64_t delta) { return in_bounds(i + delta) && !im[i + delta]; });
+    });
+
+    return result;
+}
+
+Mask im_invert(Mask im)
+{
+    parallel_for(0, im.size(), mask_grain, [&](std::size_t begin, std::size_t end) {
+        std::transform(im.begin() + begin, im.begin() + end, im.begin() + begin, [](std::uint8_t v) { return v ^ 1; });
+    });
+
+    return im;
+}
+
+Mask im_or(Mask im1, const Mask& im2)
+{
+    parallel_for(0, im1.size(), mask_grain, [&](std::size_t begin, std::size_t end) {
+        std::transform(im1.begin() + begin, im1.begin() + end, im2.begin() + begin, im1.begin() + begin, [](std::uint8_t v1, std::uint8_t v2) { return v1 | v2; });
+    });
+
+    return im1;
+}
+
+Mask im_dilate(const Mask& im, std::int64_t size)
+{
+    Mask result(im.size());
+
+    std::vector<std::int64_t> deltas { -size, -1, 0, 1, size };
+    auto in_bounds = [&](std::int64_t idx) { return idx >= 0 && idx < static_cast<std::int64_t>(im.size()); };
+
+    neighbourhood_op(im, result, size, active_kernels().dilate, [&](std::int64_t i) {
+        return std::any_of(deltas.begin(), deltas.end(), [&](std::int64_t delta) { return in_bounds(i + delta) && im[i + delta]; });
+    });
+
+    return result;
+}
+
+std::vector<std::pair<float, float>> im_collect_points(const Mask& im, std::uint64_t size)
+{
+    // Row chunks collect into their own vectors, concatenated in row order.
+    std::uint64_t grain = 64;
+    std::vector<std::vector<std::pair<float, float>>> chunks((size + grain - 1) / grain);
+    parallel_for(0, size, grain, [&](std::uint64_t begin, std::uint64_t end) {
+        auto& points = chunks[begin / grain];
+        for (std::uint64_t y = begin; y < end; ++y) {
+            float ci = std::lerp(-2.0f, 2.0f, static_cast<float>(y) / size);
+            for (std::uint64_t x = 0; x < size; ++x) {
+                float cr = std::lerp(-2.0f, 2.0f, static_cast<float>(x) / size);
+                if (im[y * size + x]) {
+                    points.emplace_back(cr, ci);
+                }
+            }
+        }
+    });
+
+    std::vector<std::pair<float, float>> points;
+    for (const auto& chunk : chunks) {
+        points.insert(points.end(), chunk.begin(), chunk.end());
+    }
+
+    return points;
+}
+
+Mask seed_mask(std::uint64_t size, std::uint64_t max_iter, std::uint64_t n_dilations, bool verbose, Formula formula, const std::atomic<bool>* cancelled)
+{
+    auto status = [&](const char* msg) {
+        if (verbose) {
+            std::cout << msg;
+            std::cout.flush();
+        }
+    };
+
+    status("Rendering binary mandelbrot ... ");
+    Mask im = binary_mandelbrot(size, max_iter, formula, cancelled);
+    status("done\n");
+
+    status("Collecting edge points ... ");
+    Mask result = im_edge(im, size);
+    Mask reverse_edge = im_edge(im_invert(im), size);
+    result = im_or(result, reverse_edge);
+
+    for (std::uint64_t i = 0; i < n_dilations && !is_cancelled(cancelled); ++i) {
+        im = im_dilate(im, size);
+        Mask dilated_reverse_edge = im_edge(im_invert(im), size);
+        result = im_or(result, dilated_reverse_edge);
+    }
+    status("done\n");
+
+    return result;
+}
+
+std::vector<std::pair<float, float>> find_good_points(std::uint64_t size, std::uint64_t max_iter, std::uint64_t n_dilations, bool verbose, Formula formula, const std::atomic<bool>* cancelled)
+{
+    Mask mask = seed_mask(size, max_iter, n_dilations, verbose, formula, cancelled);
+    if (is_cancelled(cancelled)) {
+        return {};
+    }
+
+    return im_collect_points(mask, size);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "formula.h"
+
+using Mask = std::vector<std::uint8_t>;
+
+// Escape-time mask of the formula's set over [-2, 2]^2. Once cancelled is
+// set, the seed functions skip their remaining work and return partial
+// results the caller has to discard.
+Mask binary_mandelbrot(std::uint64_t size, std::uint64_t max_iter, Formula formula = Formula::mandelbrot, const std::atomic<bool>* cancelled = nullptr);
+
+Mask im_edge(const Mask& im, std::int64_t size);
+Mask im_invert(Mask im);
+Mask im_or(Mask im1, const Mask& im2);
+Mask im_dilate(const Mask& im, std::int64_t size);
+std::vector<std::pair<float, float>> im_collect_points(const Mask& im, std::uint64_t size);
+
+Mask seed_mask(std::uint64_t size, std::uint64_t max_iter, std::uint64_t n_dilations, bool verbose = true, Formula formula = Formula::mandelbrot, const std::atomic<bool>* cancelled = nullptr);
+std::vector<std::pair<float, float>> find_good_points(std::uint64_t size, std::uint64_t max_iter, std::uint64_t n_dilations, bool verbose = true, Formula formula = Formula::mandelbrot, const std::atomic<bool>* cancelled = nullptr);
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "formula.h"
+
+// Kernel bodies shared by every ISA variant in dispatch.cpp. They are forced
+// inline so each target-specific wrapper gets its own vectorized copy.
+#define KERNEL_INLINE [[gnu::always_inline]] inline
+
+namespace kernels {
+
+constexpr std::size_t lanes = 16;
+
+template <typename T>
+using mask_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+
+// Bitwise select, so lane updates stay branch free and vectorize without
+// changing any result bits.
+template <typename T>
+KERNEL_INLINE T select(mask_t<T> mask, T a, T b)
+{
+    return std::bit_cast<T>((std::bit_cast<mask_t<T>>(a) & mask) | (std::bit_cast<mask_t<T>>(b) & ~mask));
+}
+
+// One value per lane of the lane kernels. Number types made of several
+// doubles specialize it to keep each component in an array of its own, so the
+// lane loops vectorize over them like over double.
+template <typename T>
+struct LaneArray {
+    T values[lanes];
+
+    KERNEL_INLINE T get(std::size_t l) const
+    {
+        return values[l];
+    }
+
+    KERNEL_INLINE void set(std::size_t l, T v)
+    {
+        values[l] = v;
+    }
+
+    KERNEL_INLINE void select(std::size_t l, mask_t<T> mask, T v)
+    {
+        values[l] = kernels::select(mask, v, values[l]);
+    }
+};
+
+// Pixel coordinate of v on an axis starting at lo. Number types wider than
+// double only take the offset from lo in full precision; the rest is done in
+// double, which keeps far more bits than any pixel index needs.
+template <typename T>
+KERNEL_INLINE std::int32_t pixel_coord(T v, T lo, T scale, T max)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        return static_cast<std::int32_t>(std::clamp((v - lo) * scale, T { 0 }, max));
+    } else {
+        return pixel_coord(static_cast<double>(v - lo), 0.0, static_cast<double>(scale), static_cast<double>(max));
+    }
+}
+
+// Maps the complex viewport [re_min, re_max] x [im_min, im_max] onto a
+// width x height histogram. With conjugate set, every point is mapped
+// together with its mirror image: for a viewport symmetric about the real
+// axis that is the mirrored pixel row, otherwise the conjugate point is
+// mapped on its own.
+template <typename T>
+struct PixelMap {
+    T re_min, re_max, im_min, im_max;
+    T scale_x, scale_y;
+    std::uint64_t width, height;
+    bool symmetric;
+    bool conjugate;
+
+    // Bounds may come in a wider type than T; the extents are taken in that
+    // type before rounding.
+    template <typename Bound>
+    static PixelMap make(Bound re_min, Bound re_max, Bound im_min, Bound im_max, std::uint64_t width, std::uint64_t height, bool conjugate = true)
+    {
+        return {
+            static_cast<T>(re_min), static_cast<T>(re_max), static_cast<T>(im_min), static_cast<T>(im_max),
+            static_cast<T>(width - 1) / static_cast<T>(re_max - re_min),
+            static_cast<T>(height - 1) / static_cast<T>(im_max - im_min),
+            width, height,
+            im_min == -im_max,
+            conjugate
+        };
+    }
+
+    // Points mapped per orbit point.
+    std::uint64_t n_images() const
+    {
+        return conjugate ? 2 : 1;
+    }
+
+    // True when the viewport leaves out part of [-2, 2]^2, so tracking which
+    // orbits enter it can pay off.
+    bool zoomed() const
+    {
+        return re_min > T { -2.0 } || re_max < T { 2.0 } || im_min > T { -2.0 } || im_max < T { 2.0 };
+    }
+
+    KERNEL_INLINE bool contains(T re, T im) const
+    {
+        return (re >= re_min) & (re <= re_max) & (im >= im_min) & (im <= im_max);
+    }
+};
+
+// z^N by a square-and-multiply chain unrolled at compile time. N = 2 is the
+// same operation order as std::complex z * z.
+template <unsigned N, typename T>
+KERNEL_INLINE void complex_power(T r, T i, T& pr, T& pi)
+{
+    if constexpr (N == 1) {
+        pr = r;
+        pi = i;
+    } else if constexpr (N % 2 == 0) {
+        T hr, hi;
+        complex_power<N / 2>(r, i, hr, hi);
+        pr = hr * hr - hi * hi;
+        pi = hr * hi + hi * hr;
+    } else {
+        T hr, hi;
+        complex_power<N - 1>(r, i, hr, hi);
+        pr = hr * r - hi * i;
+        pi = hr * i + hi * r;
+    }
+}
+
+// One step z -> f(z) + c, written to (nr, ni).
+template <Formula F, typename T>
+KERNEL_INLINE void iterate(T r, T i, T cr, T ci, T& nr, T& ni)
+{
+    if constexpr (F == Formula::burning_ship) {
+        using std::abs;
+        r = abs(r);
+        i = abs(i);
+    }
+
+    T pr, pi;
+    complex_power<formula_power(F)>(r, i, pr, pi);
+    if constexpr (F == Formula::tricorn) {
+        pi = -pi;
+    }
+
+    nr = pr + cr;
+    ni = pi + ci;
+}
+
+// Iterates z -> f(z) + c for n values of c side by side. iters receives the
+// number of iterations done while |z|^2 < bailout (at most max_iter), zr and
+// zi the final z and peaks the largest |z|^2 along the orbit. Matches the
+// scalar loop over iterate<F> bit for bit.
+//
+// With TrackViewport, entered[k] is set when some orbit point, or its
+// conjugate for formulas with conjugate symmetry, lies inside map's viewport,
+// and peaks is not written.
+//
+// Lanes whose orbit has finished are refilled with the next c every
+// refill_interval steps, so a few slow orbits don't leave the rest idle.
+// C is the type the lanes compute in. It may differ from the stored type T
+// when a variant wants another flavour of the same number type, and converts
+// to and from it without changing any value.
+template <bool TrackViewport, Formula F, typename T, typename C>
+KERNEL_INLINE void escape_lanes(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, const PixelMap<T>* map, std::uint64_t* iters, T* zr_out, T* zi_out, T* peaks, std::uint8_t* entered)
+{
+    using M = mask_t<T>;
+    constexpr std::size_t refill_interval = 8;
+    constexpr std::size_t idle = static_cast<std::size_t>(-1);
+
+    LaneArray<C> zr, zi, lr, li, peak;
+    M it[lanes], seen[lanes];
+    std::size_t slot[lanes];
+    M limit = static_cast<M>(max_iter);
+    C radius = static_cast<C>(bailout);
+
+    std::size_t next = 0;
+    std::size_t n_live = 0;
+    auto load = [&](std::size_t l) {
+        slot[l] = next < n ? next++ : idle;
+        bool used = slot[l] != idle;
+        lr.set(l, used ? static_cast<C>(cr[slot[l]]) : C { 0 });
+        li.set(l, used ? static_cast<C>(ci[slot[l]]) : C { 0 });
+        zr.set(l, used ? C { 0 } : radius);
+        zi.set(l, C { 0 });
+        peak.set(l, C { 0 });
+        it[l] = 0;
+        seen[l] = 0;
+        n_live += used;
+    };
+
+    for (std::size_t l = 0; l < lanes; ++l) {
+        load(l);
+    }
+
+    while (n_live > 0) {
+        for (std::size_t step = 0; step < refill_interval; ++step) {
+            for (std::size_t l = 0; l < lanes; ++l) {
+                C r = zr.get(l), im = zi.get(l);
+                C norm = r * r + im * im;
+                M active = -static_cast<M>((norm < radius) & (it[l] < limit));
+                C nr, ni;
+                iterate<F>(r, im, lr.get(l), li.get(l), nr, ni);
+                zr.select(l, active, nr);
+                zi.select(l, active, ni);
+                if constexpr (TrackViewport) {
+                    T tr = static_cast<T>(nr), ti = static_cast<T>(ni);
+                    bool inside = map->contains(tr, ti);
+                    if constexpr (conjugate_symmetric(F)) {
+                        inside |= map->contains(tr, -ti);
+                    }
+                    seen[l] |= active & -static_cast<M>(inside);
+                } else {
+                    peak.select(l, active, std::max(peak.get(l), norm));
+                }
+                it[l] -= active;
+            }
+        }
+
+        for (std::size_t l = 0; l < lanes; ++l) {
+            C r = zr.get(l), im = zi.get(l);
+            C norm = r * r + im * im;
+            if (slot[l] == idle || (norm < radius && it[l] < limit)) {
+                continue;
+            }
+
+            iters[slot[l]] = it[l];
+            zr_out[slot[l]] = static_cast<T>(r);
+            zi_out[slot[l]] = static_cast<T>(im);
+            if constexpr (TrackViewport) {
+                entered[slot[l]] = seen[l] != 0;
+            } else {
+                peaks[slot[l]] = static_cast<T>(std::max(peak.get(l), norm));
+            }
+            --n_live;
+            load(l);
+        }
+    }
+}
+
+template <Formula F, typename T, typename C = T>
+KERNEL_INLINE void escape_iterations(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, std::uint64_t* iters, T* zr, T* zi, T* peaks)
+{
+    escape_lanes<false, F, T, C>(cr, ci, n, max_iter, bailout, static_cast<const PixelMap<T>*>(nullptr), iters, zr, zi, peaks, nullptr);
+}
+
+template <Formula F, typename T, typename C = T>
+KERNEL_INLINE void escape_viewport(const T* cr, const T* ci, std::size_t n, std::uint64_t max_iter, T bailout, const PixelMap<T>& map, std::uint64_t* iters, T* zr, T* zi, std::uint8_t* entered)
+{
+    escape_lanes<true, F, T, C>(cr, ci, n, max_iter, bailout, &map, iters, zr, zi, static_cast<T*>(nullptr), entered);
+}
+
+// Maps n orbit points to histogram indices, writing the pixel of every point
+// inside the viewport and, with map.conjugate, of every conjugate point
+// inside it, and returns the number of indices written. Pixel coordinates come from a single affine map
+// per axis, which for the default [-2, 2]^2 view rounds exactly like
+// remap<T>.
+template <typename T>
+KERNEL_INLINE std::size_t orbit_pixels(const T* re, const T* im, std::size_t n, const PixelMap<T>& map, std::uint64_t* indices)
+{
+    constexpr std::size_t chunk = 256;
+    const T max_x = static_cast<T>(map.width - 1);
+    const T max_y = static_cast<T>(map.height - 1);
+
+    std::uint64_t pixel[chunk], mirror[chunk];
+    std::uint8_t inside[chunk], mirror_inside[chunk];
+    std::size_t count = 0;
+
+    for (std::size_t base = 0; base < n; base += chunk) {
+        std::size_t m = std::min(chunk, n - base);
+
+        if (!map.conjugate) {
+            for (std::size_t k = 0; k < m; ++k) {
+                T r = re[base + k];
+                T i = im[base + k];
+                inside[k] = map.contains(r, i);
+
+                std::uint64_t x = pixel_coord(r, map.re_min, map.scale_x, max_x);
+                std::uint64_t y = pixel_coord(i, map.im_min, map.scale_y, max_y);
+                pixel[k] = y * map.width + x;
+            }
+            for (std::size_t k = 0; k < m; ++k) {
+                indices[count] = pixel[k];
+                count += inside[k];
+            }
+            continue;
+        }
+
+        if (map.symmetric) {
+            for (std::size_t k = 0; k < m; ++k) {
+                T r = re[base + k];
+                T i = im[base + k];
+                inside[k] = map.contains(r, i);
+                mirror_inside[k] = inside[k];
+
+                std::uint64_t x = pixel_coord(r, map.re_min, map.scale_x, max_x);
+                std::uint64_t y = pixel_coord(i, map.im_min, map.scale_y, max_y);
+                pixel[k] = y * map.width + x;
+                mirror[k] = (map.height - y - 1) * map.width + x;
+            }
+        } else {
+            for (std::size_t k = 0; k < m; ++k) {
+                T r = re[base + k];
+                T i = im[base + k];
+                inside[k] = map.contains(r, i);
+                mirror_inside[k] = map.contains(r, -i);
+
+                std::uint64_t x = pixel_coord(r, map.re_min, map.scale_x, max_x);
+                std::uint64_t y = pixel_coord(i, map.im_min, map.scale_y, max_y);
+                std::uint64_t y_mirror = pixel_coord(-i, map.im_min, map.scale_y, max_y);
+                pixel[k] = y * map.width + x;
+                mirror[k] = y_mirror * map.width + x;
+            }
+        }
+
+        for (std::size_t k = 0; k < m; ++k) {
+            indices[count] = pixel[k];
+            count += inside[k];
+            indices[count] = mirror[k];
+            count += mirror_inside[k];
+        }
+    }
+
+    return count;
+}
+
+// 4-neighbour edge of a 0/1 mask for indices in [begin, end), which must have
+// all neighbours in bounds.
+KERNEL_INLINE void edge(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride)
+{
+    for (std::int64_t i = begin; i < end; ++i) {
+        std::uint8_t interior = im[i - stride] & im[i - 1] & im[i + 1] & im[i + stride];
+        out[i] = im[i] & (interior ^ 1);
+    }
+}
+
+// 4-neighbour dilation of a 0/1 mask, with the same bounds rules as edge.
+KERNEL_INLINE void dilate(const std::uint8_t* im, std::uint8_t* out, std::int64_t begin, std::int64_t end, std::int64_t stride)
+{
+    for (std::int64_t i = begin; i < end; ++i) {
+        out[i] = im[i - stride] | im[i - 1] | im[i] | im[i + 1] | im[i + stride];
+    }
+}
+
+KERNEL_INLINE void log_counts(const std::uint64_t* counts, std::size_t n, float* out)
+{
+    for (std::size_t k = 0; k < n; ++k) {
+        out[k] = std::log(std::max(1.0f, static_cast<float>(counts[k])));
+    }
+}
+
+// Colormap lookup with linear interpolation between table entries, producing
+// 8-bit RGB. table holds table_size RGB triples. An empty range (vmax ==
+// vmin, as in an image without hits) maps everything to the first entry.
+KERNEL_INLINE void tone_map(const float* values, std::size_t n, const float* table, std::size_t table_size, float vmin, float vmax, std::uint8_t* rgb)
+{
+    float top = static_cast<float>(table_size - 1);
+    float range = std::max(vmax - vmin, std::numeric_limits<float>::min());
+
+    for (std::size_t k = 0; k < n; ++k) {
+        float t = std::clamp((values[k] - vmin) / range, 0.0f, 1.0f);
+        float v_scaled = std::lerp(0.0f, top, t);
+        std::size_t left = std::min(static_cast<std::size_t>(v_scaled), table_size - 2);
+        float frac = v_scaled - left;
+
+        for (std::size_t ch = 0; ch < 3; ++ch) {
+            float v = std::lerp(table[3 * left + ch], table[3 * (left + 1) + ch], frac);
+            rgb[3 * k + ch] = static_cast<std::uint8_t>(std::min(255, static_cast<int>(256 * v)));
+        }
+    }
+}
+
+}
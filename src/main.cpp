@@ -1,348 +1,657 @@
-#include <algorithm>
 #include <chrono>
-#include <cmath>
-#include <complex>
 #include <cstdint>
+#include <exception>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
-#include <random>
-#include <thread>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
-#include "cmap.h"
+#include "batch.h"
+#include "bench.h"
+#include "dispatch.h"
+#include "golden.h"
+#include "pool.h"
+#include "render.h"
+#include "renderer.h"
+#include "serve.h"
 
-std::vector<bool> binary_mandelbrot(std::uint64_t size, std::uint64_t max_iter)
-{
-    std::vector<bool> result(size * size);
+namespace {
 
-    float delta = 4.0f / size;
-    std::random_device rd;
-    std::default_random_engine eng;
+class Args {
+    std::vector<std::string> args;
+    std::size_t pos = 0;
 
-    std::uniform_real_distribution offset(-0.25f * delta, 0.25f * delta);
+public:
+    Args(std::vector<std::string> args)
+        : args(std::move(args))
+    {
+    }
 
-    for (std::uint64_t y = 0; y < size; ++y) {
-        float im = std::lerp(-2.0f, 2.0f, static_cast<float>(y) / size);
-        for (std::uint64_t x = 0; x < size; ++x) {
-            float re = std::lerp(-2.0f, 2.0f, static_cast<float>(x) / size);
+    bool done() const { return pos >= args.size(); }
 
-            std::complex<float> c { re + offset(eng), im + offset(eng) };
-            std::complex<float> z {};
+    const std::string& peek() const { return args[pos]; }
 
-            for (std::uint64_t i = 0; i < max_iter && std::norm(z) < 4.0f; ++i) {
-                z = z * z + c;
-            }
+    std::string next() { return args[pos++]; }
 
-            if (std::norm(z) < 4.0f) {
-                result[y * size + x] = true;
-            }
+    std::string value(const std::string& flag)
+    {
+        if (done()) {
+            throw std::invalid_argument("Missing value for " + flag);
         }
-    }
 
-    return result;
-}
+        return next();
+    }
+};
 
-std::vector<bool> im_edge(const std::vector<bool>& im, std::int64_t size)
+template <typename T>
+T parse(const std::string& str)
 {
-    std::vector<bool> result(im.size());
-
-    std::vector<std::int64_t> deltas { -size, -1, 1, size };
-    auto in_bounds = [&](std::int64_t idx) { return idx >= 0 && idx < im.size(); };
-
-    for (std::int64_t i = 0; i < im.size(); ++i) {
-        result[i] = im[i] && std::any_of(deltas.begin(), deltas.end(), [&](std::int64_t delta) { return in_bounds(i + delta) && !im[i + delta]; });
+    std::istringstream iss(str);
+    T value;
+    if (!(iss >> value) || !iss.eof()) {
+        throw std::invalid_argument("Invalid value '" + str + "'");
     }
 
-    return result;
+    return value;
 }
 
-std::vector<bool> im_invert(std::vector<bool> im)
+template <typename T>
+std::vector<T> parse_list(const std::string& str)
 {
-    std::transform(im.begin(), im.end(), im.begin(), [](bool v) { return !v; });
+    std::vector<T> values;
+    std::istringstream iss(str);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        values.push_back(parse<T>(item));
+    }
 
-    return im;
+    return values;
 }
 
-std::vector<bool> im_or(std::vector<bool> im1, const std::vector<bool>& im2)
+// Comma separated MIN:MAX orbit length windows, for bands or frames.
+std::vector<IterWindow> parse_windows(const std::string& s)
 {
-    std::transform(im1.begin(), im1.end(), im2.begin(), im1.begin(), [](bool v1, bool v2) { return v1 || v2; });
+    std::vector<IterWindow> windows;
+    std::istringstream iss(s);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        auto colon = item.find(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("Invalid window '" + item + "', expected MIN:MAX");
+        }
+        windows.emplace_back(parse<std::uint64_t>(item.substr(0, colon)), parse<std::uint64_t>(item.substr(colon + 1)));
+    }
 
-    return im1;
+    return windows;
 }
 
-std::vector<bool> im_dilate(const std::vector<bool>& im, std::int64_t size)
+// FROM:TO:N
+FrameSweep parse_sweep(const std::string& s, bool lower_end)
 {
-    std::vector<bool> result(im.size());
+    std::vector<std::string> items;
+    std::istringstream iss(s);
+    std::string item;
+    while (std::getline(iss, item, ':')) {
+        items.push_back(item);
+    }
+    if (items.size() != 3) {
+        throw std::invalid_argument("Invalid sweep '" + s + "', expected FROM:TO:N");
+    }
 
-    std::vector<std::int64_t> deltas { -size, -1, 0, 1, size };
-    auto in_bounds = [&](std::int64_t idx) { return idx >= 0 && idx < im.size(); };
+    return { lower_end, parse<std::uint64_t>(items[0]), parse<std::uint64_t>(items[1]), parse<std::size_t>(items[2]) };
+}
 
-    for (std::int64_t i = 0; i < im.size(); ++i) {
-        result[i] = std::any_of(deltas.begin(), deltas.end(), [&](std::int64_t delta) { return in_bounds(i + delta) && im[i + delta]; });
+// RE_MIN,RE_MAX,IM_MIN,IM_MAX,WIDTH,HEIGHT,FILE
+RenderTarget parse_target(const std::string& s)
+{
+    std::istringstream iss(s);
+    std::vector<std::string> items;
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        items.push_back(item);
+    }
+    if (items.size() != 7) {
+        throw std::invalid_argument("Invalid target '" + s + "', expected RE_MIN,RE_MAX,IM_MIN,IM_MAX,WIDTH,HEIGHT,FILE");
     }
 
-    return result;
+    return {
+        parse<DoubleDouble>(items[0]), parse<DoubleDouble>(items[1]), parse<DoubleDouble>(items[2]), parse<DoubleDouble>(items[3]),
+        parse<std::uint64_t>(items[4]), parse<std::uint64_t>(items[5]),
+        items[6]
+    };
 }
 
-std::vector<std::pair<float, float>> im_collect_points(std::vector<bool> im, std::uint64_t size)
+bool parse_render_arg(RenderConfig& config, const std::string& flag, Args& args)
 {
-    std::vector<std::pair<float, float>> points;
-
-    for (std::uint64_t y = 0; y < size; ++y) {
-        float ci = std::lerp(-2.0f, 2.0f, static_cast<float>(y) / size);
-        for (std::uint64_t x = 0; x < size; ++x) {
-            float cr = std::lerp(-2.0f, 2.0f, static_cast<float>(x) / size);
-            if (im[y * size + x]) {
-                points.emplace_back(cr, ci);
-            }
+    if (flag == "--size") {
+        config.size = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--width") {
+        config.width = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--height") {
+        config.height = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--viewport") {
+        std::vector<DoubleDouble> view = parse_list<DoubleDouble>(args.value(flag));
+        if (view.size() != 4) {
+            throw std::invalid_argument("--viewport expects RE_MIN,RE_MAX,IM_MIN,IM_MAX");
         }
+        config.re_min = view[0];
+        config.re_max = view[1];
+        config.im_min = view[2];
+        config.im_max = view[3];
+    } else if (flag == "--target") {
+        config.targets.push_back(parse_target(args.value(flag)));
+    } else if (flag == "--max-iter") {
+        config.max_iter = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--seed-max-iter") {
+        config.seed_max_iter = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--dilations") {
+        config.n_dilations = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--threads") {
+        config.n_threads = parse<std::size_t>(args.value(flag));
+    } else if (flag == "--points") {
+        config.points_per_thread = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--p-uniform") {
+        config.p_uniform = parse<float>(args.value(flag));
+    } else if (flag == "--box-scale") {
+        config.box_scale = parse<float>(args.value(flag));
+    } else if (flag == "--precision") {
+        config.precision = args.value(flag);
+    } else if (flag == "--formula") {
+        config.formula = args.value(flag);
+    } else if (flag == "--seed") {
+        config.seed = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--prefilter") {
+        config.prefilter = true;
+    } else if (flag == "--prefilter-guard") {
+        config.prefilter_guard = parse<float>(args.value(flag));
+    } else if (flag == "--orbit-mode") {
+        config.orbit_mode = args.value(flag);
+    } else if (flag == "--recompute-threshold") {
+        config.recompute_threshold = parse<std::uint64_t>(args.value(flag));
+    } else if (flag == "--bands") {
+        config.bands = parse_windows(args.value(flag));
+    } else if (flag == "--frames") {
+        config.frames = parse_windows(args.value(flag));
+    } else if (flag == "--sweep-max-iter") {
+        config.sweep = parse_sweep(args.value(flag), false);
+    } else if (flag == "--sweep-min-iter") {
+        config.sweep = parse_sweep(args.value(flag), true);
+    } else if (flag == "--anti") {
+        config.anti_output = args.value(flag);
+    } else if (flag == "--record-seeds") {
+        config.record_seeds = args.value(flag);
+    } else if (flag == "--replay-seeds") {
+        config.replay_seeds = args.value(flag);
+    } else if (flag == "--memory-limit") {
+        config.memory_limit = parse<std::uint64_t>(args.value(flag)) << 20;
+    } else if (flag == "--splatters") {
+        config.n_splatters = parse<std::size_t>(args.value(flag));
+    } else if (flag == "--ring-capacity") {
+        config.ring_capacity = parse<std::size_t>(args.value(flag));
+    } else if (flag == "--generic") {
+        config.specialize = false;
+    } else if (flag == "--isa") {
+        config.isa = args.value(flag);
+    } else if (flag == "--workers") {
+        config.n_workers = parse<std::size_t>(args.value(flag));
+    } else if (flag == "--pin") {
+        config.pin_workers = true;
+    } else if (flag == "--cmap") {
+        config.cmap = args.value(flag);
+    } else if (flag == "-o" || flag == "--output") {
+        config.output = args.value(flag);
+    } else if (flag == "-q" || flag == "--quiet") {
+        config.quiet = true;
+    } else {
+        return false;
     }
 
-    return points;
+    return true;
 }
 
-template <typename T>
-struct BuddhabrotThread {
-    std::uint64_t size;
-    std::uint64_t max_iter;
-    std::vector<std::uint64_t> counts;
-    float p_uniform;
-    const std::vector<std::pair<float, float>>& good_points;
-    float point_radius;
-    std::uint64_t progress;
-
-    void sample(std::uint64_t n_points)
-    {
-        std::random_device rd;
-        std::default_random_engine eng(rd());
-        std::uniform_real_distribution uniform(T{-2.0}, T{2.0});
-        std::bernoulli_distribution use_uniform(p_uniform);
-        std::uniform_int_distribution point_idx_dist(0UL, good_points.size() - 1);
-
-        std::vector<std::complex<T>> points;
-        points.reserve(max_iter);
-
-        for (std::uint64_t k = 0; k < n_points; ++k) {
-            if (k % 1000 == 0) {
-                progress = k + 1;
-            }
-
-            std::complex<T> c;
-            if (use_uniform(eng)) {
-                c = std::complex<T> { uniform(eng), uniform(eng) };
-            } else {
-                auto [rmid, imid] = good_points[point_idx_dist(eng)];
-                std::uniform_real_distribution<T> r_dist(rmid - point_radius, rmid + point_radius);
-                std::uniform_real_distribution<T> i_dist(imid - point_radius, imid + point_radius);
-
-                c = std::complex<T> { r_dist(eng), i_dist(eng) };
-            }
-
-            points.clear();
-            std::complex<T> z {};
-
-            for (std::uint64_t i = 0; i < max_iter && std::norm(z) < T{8.0}; ++i) {
-                z = z * z + c;
-                points.push_back(z);
-            }
-
-            if (std::norm(z) < T{4.0}) {
-                continue;
-            }
-
-            for (auto z_sample : points) {
-                if (std::abs(z_sample.real()) > T{2.0} || std::abs(z_sample.imag()) > T{2.0}) {
-                    continue;
-                }
-
-                std::int64_t x = remap<T>(-2.0, 2.0, 0, size - 1, z_sample.real());
-                std::int64_t y = remap<T>(-2.0, 2.0, 0, size - 1, z_sample.imag());
-
-                counts[y * size + x]++;
-                counts[(size - y - 1) * size + x]++;
-            }
+RenderConfig parse_sampler_spec(RenderConfig config, const std::string& spec)
+{
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        auto eq = item.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument("Invalid sampler setting '" + item + "'");
         }
 
-        progress = n_points;
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        if (key == "p_uniform") {
+            config.p_uniform = parse<float>(value);
+        } else if (key == "box_scale") {
+            config.box_scale = parse<float>(value);
+        } else if (key == "dilations") {
+            config.n_dilations = parse<std::uint64_t>(value);
+        } else if (key == "seed_max_iter") {
+            config.seed_max_iter = parse<std::uint64_t>(value);
+        } else {
+            throw std::invalid_argument("Unknown sampler setting '" + key + "'");
+        }
     }
-};
 
-void print_duration(std::ostream& os, float secs)
+    return config;
+}
+
+// Also sets up the default pool, which every phase of every render runs on.
+void use_isa(const RenderConfig& config)
 {
-    int whole_secs = std::lround(secs);
-    int mins = whole_secs / 60;
-    int mod_secs = whole_secs % 60;
+    Isa isa = select_isa(config.isa);
+    configure_default_pool(config.n_workers, config.pin_workers);
+    if (!config.quiet) {
+        std::cout << "Using " << isa_name(isa) << " kernels" << (config.isa == "auto" ? "" : " (forced)") << ", "
+                  << default_pool().size() << " pool workers" << (config.pin_workers ? " (pinned)" : "") << "\n";
+    }
+}
 
-    os << std::setfill('0') << std::setw(2) << mins << ":";
-    os << std::setfill('0') << std::setw(2) << mod_secs;
+void print_usage()
+{
+    std::cout << "usage: buddhabrot [options]\n"
+              << "       buddhabrot bench-scaling [--weak] [--threads-list N,...] [--sizes N,...] [--max-iters N,...] [--points N] [--csv FILE] [options]\n"
+              << "       buddhabrot golden [--write] [--dir DIR] [--tolerance T]\n"
+              << "       buddhabrot bench-sampler [--sampler SPEC]... [--budgets N,...] [--reference-points N] [--reference FILE] [--csv FILE] [options]\n"
+              << "       buddhabrot serve [--socket PATH] [options]\n"
+              << "       buddhabrot batch MANIFEST [--workers N] [--in-flight N] [options]\n"
+              << "\n"
+              << "options:\n"
+              << "  --size N            image width and height (4096)\n"
+              << "  --width N           output width (--size)\n"
+              << "  --height N          output height (--size)\n"
+              << "  --viewport A,B,C,D  complex plane region re in [A, B], im in [C, D] (-2,2,-2,2)\n"
+              << "  --target A,B,C,D,W,H,FILE  also render viewport [A, B] x [C, D] at WxH to FILE (repeatable)\n"
+              << "  --max-iter N        maximum orbit length (20)\n"
+              << "  --seed-max-iter N   iterations for the seed mandelbrot (1000)\n"
+              << "  --dilations N       seed mask dilations (2)\n"
+              << "  --threads N         sampling threads (12)\n"
+              << "  --points N          samples per thread (100000000)\n"
+              << "  --p-uniform P       probability of sampling c uniformly (1.0)\n"
+              << "  --box-scale S       size of the boxes sampled around seed points (1.0)\n"
+              << "  --precision P       sampling precision, float, double or double-double (double)\n"
+              << "  --formula NAME      mandelbrot, multibrot3 to multibrot6, tricorn or burning-ship (mandelbrot)\n"
+              << "  --seed N            fixed random seed, 0 for a random seed (0)\n"
+              << "  --prefilter         reject bounded orbits with a float escape test first\n"
+              << "  --prefilter-guard G relative band below the bailout recomputed in full precision (0.05)\n"
+              << "  --orbit-mode M      store, recompute or auto (auto)\n"
+              << "  --recompute-threshold N  max_iter from which auto tries recompute (10000)\n"
+              << "  --bands A:B,...     Nebulabrot: escape time bands for red, green, blue (overrides --max-iter)\n"
+              << "  --frames A:B,...    frame sequence: one image per orbit length window, OUTPUT_0000.ppm etc.\n"
+              << "  --sweep-max-iter A:B:N  N frames with orbit lengths up to A ... B\n"
+              << "  --sweep-min-iter A:B:N  N frames with orbit lengths from A ... B up to --max-iter\n"
+              << "  --anti FILE         also write the anti-Buddhabrot of bounded orbits to FILE\n"
+              << "  --record-seeds FILE save every escaping c with its orbit length to FILE\n"
+              << "  --replay-seeds FILE splat the seeds in FILE instead of sampling\n"
+              << "  --memory-limit MB   render in strips, one pass each, when the histograms would exceed MB (0, off)\n"
+              << "  --splatters N       pipeline: --threads finders feed N splatter threads (0, off)\n"
+              << "  --ring-capacity N   escapes buffered per finder/splatter ring (4096)\n"
+              << "  --generic           disable the max_iter and size specialized kernels\n"
+              << "  --isa ISA           kernel variant: auto, sse2, avx2 or avx512 (auto)\n"
+              << "  --workers N         thread pool size, 0 for one worker per hardware thread (0)\n"
+              << "  --pin               pin pool workers to CPUs\n"
+              << "  --cmap NAME         colormap (mako)\n"
+              << "  -o, --output FILE   output image (out20.ppm)\n"
+              << "  -q, --quiet         no progress output\n";
 }
 
-void print_progress(std::uint64_t progress, std::uint64_t max_progress, std::chrono::duration<float> elapsed)
+int run_render(Args& args)
 {
-    std::uint64_t width = 32;
-
-    std::string csi = "\033[";
-    std::cout << csi << "1K" << csi << "G";
-
-    std::vector<std::string> eighths {
-        " ",
-        "▏",
-        "▎",
-        "▍",
-        "▌",
-        "▋",
-        "▊",
-        "▊",
-        "█"
-    };
+    RenderConfig config;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (!parse_render_arg(config, flag, args)) {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
+    }
 
-    int whole = (width * progress) / max_progress;
-    int part = (8 * width * progress) / max_progress - 8 * whole;
+    use_isa(config);
+    RenderStats stats = render(config);
 
-    std::cout << "[";
-    for (int i = 0; i < whole; ++i) {
-        std::cout << eighths.back();
+    std::cout << "Sampled " << stats.n_samples << " points in " << std::fixed << std::setprecision(3) << stats.sample_seconds << "s ("
+              << std::setprecision(2) << stats.n_samples / stats.sample_seconds / 1e6 << " Msamples/s), merged in "
+              << std::setprecision(3) << stats.merge_seconds << "s\n";
+    if (config.prefilter) {
+        std::cout << "Prefilter rejected " << stats.n_prefiltered << " samples, " << stats.n_guarded << " fell in the guard band\n";
     }
-
-    if (progress != max_progress) {
-        std::cout << eighths[part] << std::string(width - whole - 1, ' ');
+    if (config.n_splatters > 0) {
+        const PipelineStats& p = stats.pipeline;
+        std::cout << "Pipeline: " << config.n_threads << " finders, " << config.n_splatters << " splatters, ring occupancy mean "
+                  << std::setprecision(1) << 100.0 * p.mean_occupancy << "% max " << p.max_occupancy << "/" << p.ring_capacity
+                  << ", " << p.n_full_stalls << " finder stalls, " << p.n_empty_polls << " empty splatter polls\n";
+    }
+    if (stats.n_orbit_points > 0) {
+        std::cout << "Splatted " << std::setprecision(2) << 100.0 * stats.n_splatted / stats.n_orbit_points
+                  << "% of orbit points inside the viewport";
+        if (stats.n_outside > 0) {
+            std::cout << ", " << stats.n_outside << " escaping orbits never entered it";
+        }
+        std::cout << "\n";
+    }
+    if (stats.n_tiles > 0) {
+        std::cout << "Allocated " << stats.n_tiles_touched << " of " << stats.n_tiles << " histogram tiles ("
+                  << std::setprecision(1) << 100.0 * stats.n_tiles_touched / stats.n_tiles << "%)\n";
+    }
+    if (!config.frames.empty() || config.sweep.n_frames > 0) {
+        std::cout << "Wrote " << iter_windows(config).size() << " frames from " << stats.n_bands << " orbit length bands\n";
+    }
+    if (stats.n_strips > 1) {
+        std::cout << "Rendered out of core in " << stats.n_strips << " strips of " << stats.strip_rows << " rows, one sampling pass each\n";
+    }
+    if (!config.record_seeds.empty()) {
+        std::cout << "Recorded " << stats.n_recorded << " escaping seeds to " << config.record_seeds << "\n";
+    }
+    if (!config.replay_seeds.empty()) {
+        std::cout << "Replayed " << stats.n_samples << " of " << stats.n_replay_seeds << " seeds recorded from "
+                  << stats.n_replay_samples << " samples, " << stats.n_escaped << " still escaped\n";
+    }
+    for (std::size_t t = 0; t < config.targets.size(); ++t) {
+        std::cout << "Target " << config.targets[t].output << ": " << stats.target_hits[t] << " hits, dense storage in "
+                  << stats.target_dense[t] << " of " << (config.n_splatters > 0 ? config.n_splatters : config.n_threads) << " histograms\n";
+    }
+    if (!config.anti_output.empty()) {
+        std::cout << "Anti-Buddhabrot: " << stats.n_cycles << " cycles splatted, " << stats.n_aperiodic << " bounded orbits without a detected cycle\n";
+    }
+    if (stats.n_unseeded > 0) {
+        std::cout << "Drew " << stats.n_unseeded << " uniform samples while the seed points were computed\n";
+    }
+    if (stats.n_recomputed > 0) {
+        std::cout << "Recomputed orbits for " << stats.n_recomputed << " samples, escape fraction "
+                  << std::setprecision(4) << static_cast<double>(stats.n_escaped) / stats.n_samples << "\n";
     }
 
-    float ratio = static_cast<float>(progress) / max_progress;
-    std::cout << "] " << std::fixed << std::setprecision(1) << (100.0f * ratio) << "%";
+    return 0;
+}
 
-    std::cout << "(";
-    float estimate = elapsed.count() / ratio;
-    print_duration(std::cout, elapsed.count());
-    std::cout << "/";
-    if (elapsed.count() < 2.0f) {
-        std::cout << "--:--";
-    } else {
-        print_duration(std::cout, estimate);
+int run_bench_scaling(Args& args)
+{
+    ScalingBenchConfig config;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (flag == "--weak") {
+            config.weak = true;
+        } else if (flag == "--threads-list") {
+            config.threads = parse_list<std::size_t>(args.value(flag));
+        } else if (flag == "--sizes") {
+            config.sizes = parse_list<std::uint64_t>(args.value(flag));
+        } else if (flag == "--max-iters") {
+            config.max_iters = parse_list<std::uint64_t>(args.value(flag));
+        } else if (flag == "--points") {
+            config.points = parse<std::uint64_t>(args.value(flag));
+        } else if (flag == "--csv") {
+            config.csv = args.value(flag);
+        } else if (!parse_render_arg(config.render, flag, args)) {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
     }
-    std::cout << ")";
 
-    std::cout.flush();
+    use_isa(config.render);
+    bench_scaling(config);
+
+    return 0;
 }
 
-template <typename T>
-std::vector<std::uint64_t> merge_results(const std::vector<BuddhabrotThread<T>>& threads)
+int run_bench_sampler(Args& args)
 {
-    std::vector<std::uint64_t> result(threads.front().size * threads.front().size);
+    SamplerBenchConfig config;
+    config.render.size = 512;
+    config.render.max_iter = 1000;
+
+    std::vector<std::string> specs;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (flag == "--sampler") {
+            specs.push_back(args.value(flag));
+        } else if (flag == "--budgets") {
+            config.budgets = parse_list<std::uint64_t>(args.value(flag));
+        } else if (flag == "--reference-points") {
+            config.reference_points = parse<std::uint64_t>(args.value(flag));
+        } else if (flag == "--reference") {
+            config.reference = args.value(flag);
+        } else if (flag == "--csv") {
+            config.csv = args.value(flag);
+        } else if (!parse_render_arg(config.render, flag, args)) {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
+    }
 
-    for (const auto& thread : threads) {
-        std::transform(result.begin(), result.end(), thread.counts.begin(), result.begin(), [](std::uint64_t cur, std::uint64_t res) { return cur + res; });
+    if (specs.empty()) {
+        specs = { "p_uniform=1", "p_uniform=0.5", "p_uniform=0", "p_uniform=0,box_scale=2" };
     }
+    for (const auto& spec : specs) {
+        config.samplers.emplace_back(spec, parse_sampler_spec(config.render, spec));
+    }
+
+    use_isa(config.render);
+    bench_sampler(config);
 
-    return result;
+    return 0;
 }
 
-std::vector<std::pair<float, float>> find_good_points(std::uint64_t size, std::uint64_t max_iter, std::uint64_t n_dilations)
+// Options of one serve request or batch job on top of defaults, which may
+// include --priority N when priority is given. Batch jobs (priority given)
+// run concurrently under the kernels selected for the whole batch, so they
+// can't set --isa. Progress output is off, since standard output carries the
+// replies and jobs may run concurrently.
+RenderConfig parse_job(const RenderConfig& defaults, const std::string& line, int* priority = nullptr)
 {
-    std::cout << "Rendering binary mandelbrot ... ";
-    std::cout.flush();
-    std::vector<bool> im = binary_mandelbrot(size, max_iter);
-    std::cout << "done\n";
+    std::istringstream iss(line);
+    Args job(std::vector<std::string> { std::istream_iterator<std::string>(iss), std::istream_iterator<std::string>() });
+
+    RenderConfig config = defaults;
+    while (!job.done()) {
+        std::string flag = job.next();
+        if (priority != nullptr && flag == "--priority") {
+            *priority = parse<int>(job.value(flag));
+        } else if (flag == "--workers" || flag == "--pin") {
+            throw std::invalid_argument(flag + " applies to the whole process, not to one job");
+        } else if (priority != nullptr && flag == "--isa") {
+            throw std::invalid_argument("--isa applies to the whole batch, not to one job");
+        } else if (!parse_render_arg(config, flag, job)) {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
+    }
+    config.quiet = true;
 
-    std::cout << "Collecting edge points ... ";
-    std::cout.flush();
-    std::vector<bool> result = im_edge(im, size);
-    std::vector<bool> reverse_edge = im_edge(im_invert(im), size);
-    result = im_or(result, reverse_edge);
+    return config;
+}
 
-    for (std::uint64_t i = 0; i < n_dilations; ++i) {
-        im = im_dilate(im, size);
-        std::vector<bool> dilated_reverse_edge = im_edge(im_invert(im), size);
-        result = im_or(result, dilated_reverse_edge);
+// "ok SECONDS FILE..." or "error MESSAGE".
+std::string describe_outcome(const BatchOutcome& outcome)
+{
+    if (!outcome.error.empty()) {
+        return "error " + outcome.error;
     }
 
-    auto good_points = im_collect_points(result, size);
-    std::cout << "done\n";
-
-    return good_points;
+    std::ostringstream oss;
+    oss << "ok " << std::fixed << std::setprecision(3) << outcome.seconds;
+    for (const auto& output : outcome.outputs) {
+        oss << " " << output;
+    }
+    return oss.str();
 }
 
-int main()
+// Render daemon: each request line holds the options of one render on top of
+// the ones serve was started with. Renders run one after the other in this
+// process, reusing cached seed masks, and are answered as described by
+// describe_outcome. "shutdown" stops the daemon.
+int run_serve(Args& args)
 {
-    std::int64_t size = 4096;
+    std::string socket_path;
+    RenderConfig defaults;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (flag == "--socket") {
+            socket_path = args.value(flag);
+        } else if (!parse_render_arg(defaults, flag, args)) {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
+    }
 
-    auto good_points = find_good_points(size, 1000, 2);
+    configure_default_pool(defaults.n_workers, defaults.pin_workers);
+    Renderer renderer;
+    auto handle = [&](const std::string& request, bool& stop) -> std::string {
+        if (request.find_first_not_of(" \t") == std::string::npos) {
+            return "error Empty request";
+        }
+        if (request == "shutdown") {
+            stop = true;
+            return "ok";
+        }
 
-    std::size_t n_threads = 12;
-    std::vector<std::thread> threads(n_threads);
+        BatchOutcome outcome;
+        auto start = std::chrono::steady_clock::now();
+        try {
+            RenderConfig config = parse_job(defaults, request);
+            select_isa(config.isa);
+            if (strip_height(config) < image_height(config)) {
+                render(config);
+                outcome.outputs.push_back(config.output);
+            } else {
+                renderer.start(config);
+                for (const Image& image : renderer.result().images) {
+                    write_ppm(image);
+                    outcome.outputs.push_back(image.output);
+                }
+            }
+        } catch (const std::exception& e) {
+            outcome.error = e.what();
+        }
+        outcome.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    BuddhabrotThread<double> buddha_template {
-        static_cast<uint64_t>(size),
-        20,
-        std::vector<std::uint64_t>(size * size),
-        1.0,
-        good_points,
-        2.0f / size,
-        0
+        return describe_outcome(outcome);
     };
 
-    std::uint64_t points_per_thread = 100000000;
-
-    std::cout << "Sampling Buddhabrot data...\n";
-    std::vector buddha_threads(n_threads, buddha_template);
-    for (std::size_t i = 0; i < n_threads; ++i) {
-        threads[i] = std::thread(&BuddhabrotThread<double>::sample, &buddha_threads[i], points_per_thread);
+    if (socket_path.empty()) {
+        serve_stream(std::cin, std::cout, handle);
+    } else {
+        serve_socket(socket_path, handle);
     }
 
-    bool done = false;
-    auto start = std::chrono::steady_clock::now();
-    while (!done) {
-        using namespace std::chrono_literals;
+    return 0;
+}
 
-        std::uint64_t total_progress = 0;
-        for (std::size_t i = 0; i < n_threads; ++i) {
-            total_progress += buddha_threads[i].progress;
+// Batch mode: the manifest holds one job per line, render options on top of
+// the ones given here plus an optional --priority N. Blank lines and lines
+// starting with # are skipped.
+int run_batch(Args& args)
+{
+    if (args.done()) {
+        throw std::invalid_argument("batch expects a manifest file");
+    }
+    std::string manifest = args.next();
+    std::size_t max_in_flight = 2;
+    RenderConfig defaults;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (flag == "--in-flight") {
+            max_in_flight = parse<std::size_t>(args.value(flag));
+        } else if (!parse_render_arg(defaults, flag, args)) {
+            throw std::invalid_argument("Unknown option " + flag);
         }
-
-        auto now = std::chrono::steady_clock::now();
-        std::chrono::duration<float> elapsed = now - start;
-        print_progress(total_progress, points_per_thread * n_threads, elapsed);
-        std::this_thread::sleep_for(100ms);
-
-        done = (total_progress >= points_per_thread * n_threads);
     }
+    use_isa(defaults);
 
-    for (std::size_t i = 0; i < n_threads; ++i) {
-        threads[i].join();
+    std::ifstream ifs(manifest);
+    if (!ifs) {
+        throw std::runtime_error("Failed to read manifest " + manifest);
+    }
+    std::vector<BatchJob> jobs;
+    std::vector<std::size_t> line_numbers;
+    std::string line;
+    for (std::size_t n = 1; std::getline(ifs, line); ++n) {
+        std::size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        BatchJob job;
+        try {
+            job.config = parse_job(defaults, line, &job.priority);
+        } catch (const std::exception& e) {
+            throw std::invalid_argument(manifest + ":" + std::to_string(n) + ": " + e.what());
+        }
+        jobs.push_back(job);
+        line_numbers.push_back(n);
     }
 
-    std::cout << "\nMerging thread results ... ";
-    std::cout.flush();
-    std::vector<std::uint64_t> result = merge_results(buddha_threads);
-    std::cout << "done\n";
+    std::size_t n_failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    render_batch(jobs, max_in_flight, [&](std::size_t j, const BatchOutcome& outcome) {
+        n_failed += !outcome.error.empty();
+        std::cout << manifest << ":" << line_numbers[j] << ": " << describe_outcome(outcome) << std::endl;
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Rendered " << jobs.size() - n_failed << " of " << jobs.size() << " jobs in " << std::fixed << std::setprecision(3)
+              << elapsed.count() << "s on " << default_pool().size() << " workers\n";
 
-    std::cout << "Writing image ... ";
-    std::cout.flush();
+    return n_failed == 0 ? 0 : 1;
+}
 
-    std::vector<float> log_image;
-    log_image.reserve(result.size());
+int run_golden(Args& args)
+{
+    std::string dir = "golden";
+    double tolerance = 0.02;
+    bool write = false;
+    while (!args.done()) {
+        std::string flag = args.next();
+        if (flag == "--write") {
+            write = true;
+        } else if (flag == "--dir") {
+            dir = args.value(flag);
+        } else if (flag == "--tolerance") {
+            tolerance = parse<double>(args.value(flag));
+        } else {
+            throw std::invalid_argument("Unknown option " + flag);
+        }
+    }
 
-    std::transform(result.begin(), result.end(), std::back_inserter(log_image), [](std::uint64_t v) { return std::log(std::max(1.0f, (float)v)); });
-    auto [vmin, vmax] = std::minmax_element(log_image.begin(), log_image.end());
+    if (write) {
+        golden_write(dir);
+        return 0;
+    }
 
-    auto to_int_rgb = [](float v) { return std::clamp(0, 255, static_cast<int>(256 * v)); };
-    auto cmap = Colormap<float>::by_name("mako");
-    cmap.set_vrange(*vmin, *vmax);
-    //cmap.set_vrange(2.0, *vmax);
+    return golden_check(dir, tolerance) ? 0 : 1;
+}
 
-    std::ofstream ofs("out20.ppm");
-    ofs << "P3\n";
-    ofs << size << " " << size << "\n";
-    ofs << "255\n";
+}
 
-    for (std::size_t y = 0; y < size; ++y) {
-        for (std::size_t x = 0; x < size; ++x) {
-            auto color = cmap(log_image[y * size + x]);
-            std::transform(color.begin(), color.end(), std::ostream_iterator<int>(ofs, " "), to_int_rgb);
+int main(int argc, char** argv)
+{
+    Args args(std::vector<std::string>(argv + 1, argv + argc));
+
+    try {
+        if (!args.done()) {
+            const std::string& first = args.peek();
+            if (first == "-h" || first == "--help") {
+                print_usage();
+                return 0;
+            } else if (first == "bench-scaling") {
+                args.next();
+                return run_bench_scaling(args);
+            } else if (first == "golden") {
+                args.next();
+                return run_golden(args);
+            } else if (first == "bench-sampler") {
+                args.next();
+                return run_bench_sampler(args);
+            } else if (first == "serve") {
+                args.next();
+                return run_serve(args);
+            } else if (first == "batch") {
+                args.next();
+                return run_batch(args);
+            }
         }
-    }
 
-    std::cout << "done\n";
+        return run_render(args);
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
 }
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "buddhabrot.h"
+#include "ring.h"
+
+struct PipelineStats {
+    double mean_occupancy = 0.0;
+    std::size_t max_occupancy = 0;
+    std::size_t ring_capacity = 0;
+    std::uint64_t n_full_stalls = 0;
+    std::uint64_t n_empty_polls = 0;
+};
+
+// Two-stage sampler. Finder threads run the store-free batched escape search
+// and push escaping c values with their orbit length into SPSC rings, one per
+// finder and splatter pair. Splatter threads drain their rings, re-iterate
+// the orbits and accumulate them into their own histograms. Finders draw
+// exactly the samples sample() would, so the merged histogram matches a
+// plain run with one thread per finder.
+template <typename T, Formula F = Formula::mandelbrot>
+class SamplePipeline {
+public:
+    struct Escape {
+        T cr;
+        T ci;
+        std::uint64_t n_orbit;
+    };
+
+    SamplePipeline(std::vector<BuddhabrotThread<T, F>>& finders, const BuddhabrotThread<T, F>& splatter, std::size_t n_splatters, std::size_t ring_capacity)
+        : finders(finders)
+        , splatters(n_splatters, splatter)
+        , finder_stats(finders.size())
+        , splatter_stats(n_splatters)
+    {
+        for (std::size_t i = 0; i < finders.size() * n_splatters; ++i) {
+            rings.push_back(std::make_unique<SpscRing<Escape>>(ring_capacity));
+        }
+    }
+
+    void start(std::uint64_t points_per_finder)
+    {
+        for (std::size_t i = 0; i < finders.size(); ++i) {
+            threads.emplace_back(&SamplePipeline::run_finder, this, i, points_per_finder);
+        }
+        for (std::size_t j = 0; j < splatters.size(); ++j) {
+            threads.emplace_back(&SamplePipeline::run_splatter, this, j);
+        }
+    }
+
+    void join()
+    {
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+    const std::vector<BuddhabrotThread<T, F>>& results() const
+    {
+        return splatters;
+    }
+
+    PipelineStats stats() const
+    {
+        PipelineStats stats;
+        stats.ring_capacity = rings.front()->capacity();
+
+        std::uint64_t occupancy_sum = 0;
+        std::uint64_t n_occupancy = 0;
+        for (const auto& s : finder_stats) {
+            stats.n_full_stalls += s.n_full_stalls;
+        }
+        for (const auto& s : splatter_stats) {
+            occupancy_sum += s.occupancy_sum;
+            n_occupancy += s.n_occupancy;
+            stats.max_occupancy = std::max(stats.max_occupancy, s.max_occupancy);
+            stats.n_empty_polls += s.n_empty_polls;
+        }
+        if (n_occupancy > 0) {
+            stats.mean_occupancy = static_cast<double>(occupancy_sum) / n_occupancy / stats.ring_capacity;
+        }
+
+        return stats;
+    }
+
+private:
+    // Padded so the per-thread counters don't share cache lines.
+    struct alignas(64) FinderStats {
+        std::uint64_t n_full_stalls = 0;
+    };
+
+    struct alignas(64) SplatterStats {
+        std::uint64_t occupancy_sum = 0;
+        std::uint64_t n_occupancy = 0;
+        std::size_t max_occupancy = 0;
+        std::uint64_t n_empty_polls = 0;
+    };
+
+    static constexpr std::size_t drain_batch = 64;
+
+    SpscRing<Escape>& ring(std::size_t finder, std::size_t splatter)
+    {
+        return *rings[finder * splatters.size() + splatter];
+    }
+
+    // Spreads escapes over the splatters round robin, skipping full rings and
+    // yielding only when every ring of this finder is full.
+    void run_finder(std::size_t i, std::uint64_t n_points)
+    {
+        std::size_t n_splatters = splatters.size();
+        std::size_t next = 0;
+
+        finders[i].find(n_points, [&](T cr, T ci, std::uint64_t n_orbit) {
+            Escape escape { cr, ci, n_orbit };
+            while (true) {
+                for (std::size_t attempt = 0; attempt < n_splatters; ++attempt) {
+                    auto& r = ring(i, next);
+                    next = (next + 1) % n_splatters;
+                    if (r.try_push(escape)) {
+                        return;
+                    }
+                }
+                ++finder_stats[i].n_full_stalls;
+                std::this_thread::yield();
+            }
+        });
+
+        for (std::size_t j = 0; j < n_splatters; ++j) {
+            ring(i, j).close();
+        }
+    }
+
+    void run_splatter(std::size_t j)
+    {
+        auto& stats = splatter_stats[j];
+        std::vector<bool> open(finders.size(), true);
+        std::size_t n_open = finders.size();
+
+        while (n_open > 0) {
+            bool popped_any = false;
+            for (std::size_t i = 0; i < finders.size(); ++i) {
+                if (!open[i]) {
+                    continue;
+                }
+
+                auto& r = ring(i, j);
+                bool closed = r.is_closed();
+                std::size_t occupancy = r.size();
+                stats.occupancy_sum += occupancy;
+                stats.n_occupancy++;
+                stats.max_occupancy = std::max(stats.max_occupancy, occupancy);
+
+                Escape escape;
+                std::size_t n_popped = 0;
+                while (n_popped < drain_batch && r.try_pop(escape)) {
+                    splatters[j].splat_orbit(escape.cr, escape.ci, escape.n_orbit);
+                    ++n_popped;
+                }
+
+                if (n_popped == 0 && closed) {
+                    open[i] = false;
+                    --n_open;
+                }
+                popped_any |= n_popped > 0;
+            }
+
+            if (!popped_any && n_open > 0) {
+                ++stats.n_empty_polls;
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::vector<BuddhabrotThread<T, F>>& finders;
+    std::vector<BuddhabrotThread<T, F>> splatters;
+    std::vector<std::unique_ptr<SpscRing<Escape>>> rings;
+    std::vector<FinderStats> finder_stats;
+    std::vector<SplatterStats> splatter_stats;
+    std::vector<std::thread> threads;
+};
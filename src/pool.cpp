@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "pool.h"
+
+namespace {
+
+void pin_to_cpu(std::thread& thread, std::size_t index)
+{
+#ifdef __linux__
+    unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % n_cpus, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+}
+
+std::mutex default_mutex;
+std::unique_ptr<TaskPool> default_instance;
+std::size_t default_workers = 0;
+bool default_pin = false;
+
+}
+
+TaskPool::TaskPool(std::size_t n_workers, bool pin)
+{
+    n_workers = std::max<std::size_t>(1, n_workers);
+    for (std::size_t i = 0; i < n_workers; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t i = 0; i < n_workers; ++i) {
+        workers.emplace_back(&TaskPool::work, this, i);
+        if (pin) {
+            pin_to_cpu(workers.back(), i);
+        }
+    }
+}
+
+// Queued tasks still run before the workers exit.
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void TaskPool::submit(std::function<void()> task, int priority)
+{
+    {
+        std::lock_guard lock(wake_mutex);
+        Queue& queue = *queues[n_submitted % queues.size()];
+        std::lock_guard queue_lock(queue.mutex);
+        queue.tasks.push({ priority, n_submitted++, std::move(task) });
+        ++n_queued;
+    }
+    wake.notify_one();
+}
+
+void TaskPool::work(std::size_t index)
+{
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task.run();
+            continue;
+        }
+
+        std::unique_lock lock(wake_mutex);
+        wake.wait(lock, [this] { return stopping || n_queued > 0; });
+        if (stopping && n_queued == 0) {
+            return;
+        }
+    }
+}
+
+bool TaskPool::run_one(int min_priority)
+{
+    Task task;
+    bool found = false;
+    for (auto& queue : queues) {
+        std::lock_guard lock(queue->mutex);
+        if (!queue->tasks.empty() && queue->tasks.top().priority >= min_priority) {
+            task = std::move(const_cast<Task&>(queue->tasks.top()));
+            queue->tasks.pop();
+            --n_queued;
+            found = true;
+            break;
+        }
+    }
+    if (found) {
+        task.run();
+    }
+
+    return found;
+}
+
+bool TaskPool::take(std::size_t index, Task& task)
+{
+    for (std::size_t k = 0; k < queues.size(); ++k) {
+        Queue& queue = *queues[(index + k) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(const_cast<Task&>(queue.tasks.top()));
+            queue.tasks.pop();
+            --n_queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TaskPool& default_pool()
+{
+    std::lock_guard lock(default_mutex);
+    if (default_instance == nullptr) {
+        std::size_t n_workers = default_workers != 0 ? default_workers : std::thread::hardware_concurrency();
+        default_instance = std::make_unique<TaskPool>(n_workers, default_pin);
+    }
+
+    return *default_instance;
+}
+
+void configure_default_pool(std::size_t n_workers, bool pin)
+{
+    std::lock_guard lock(default_mutex);
+    if (default_instance != nullptr) {
+        throw std::logic_error("The default pool is already running");
+    }
+    default_workers = n_workers;
+    default_pin = pin;
+}
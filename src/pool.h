@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running prioritized tasks, shared by any
+// number of renders. submit() spreads tasks round robin over per-worker
+// queues; a worker runs the highest priority task of its own queue (first
+// submitted first among equals) and steals from the other queues when its
+// own is empty. Tasks must not throw. With pin set, worker i is bound to
+// CPU i modulo the CPU count.
+class TaskPool {
+public:
+    // Priority of parallel_for chunks, which callers wait on.
+    static constexpr int urgent = std::numeric_limits<int>::max();
+
+    explicit TaskPool(std::size_t n_workers, bool pin = false);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    void submit(std::function<void()> task, int priority = 0);
+
+    // Runs one queued task of at least min_priority on the calling thread, if
+    // there is one, so a long task can lend its thread to urgent work.
+    bool run_one(int min_priority);
+
+    std::size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    struct Task {
+        int priority;
+        std::uint64_t order;
+        std::function<void()> run;
+
+        bool operator<(const Task& other) const
+        {
+            return priority != other.priority ? priority < other.priority : order > other.order;
+        }
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::priority_queue<Task> tasks;
+    };
+
+    void work(std::size_t index);
+    bool take(std::size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<std::size_t> n_queued { 0 };
+    std::uint64_t n_submitted = 0;
+    bool stopping = false;
+};
+
+// The process-wide pool every phase runs on, created on first use with one
+// worker per hardware thread unless configure_default_pool came first.
+TaskPool& default_pool();
+
+// Sets the size (0 for one worker per hardware thread) and pinning of the
+// default pool. Throws once the pool exists.
+void configure_default_pool(std::size_t n_workers, bool pin);
+
+// Calls fn(begin, end) for the chunks [first, last) splits into at grain
+// elements each, on the pool's workers and the calling thread, and returns
+// once every chunk is done. The caller keeps taking chunks itself, so this
+// also makes progress when called from inside a pool task with every worker
+// busy. fn must not throw.
+template <typename Fn>
+void parallel_for(std::size_t first, std::size_t last, std::size_t grain, Fn&& fn, TaskPool& pool = default_pool())
+{
+    if (first >= last) {
+        return;
+    }
+    grain = std::max<std::size_t>(1, grain);
+    std::size_t n_chunks = (last - first + grain - 1) / grain;
+    if (n_chunks == 1) {
+        fn(first, last);
+        return;
+    }
+
+    // Helpers that only start after the last chunk is taken touch nothing
+    // but this state, which they keep alive.
+    struct State {
+        std::atomic<std::size_t> next { 0 };
+        std::atomic<std::size_t> n_done { 0 };
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+
+    auto run_chunks = [state, first, last, grain, n_chunks, &fn] {
+        std::size_t chunk;
+        while ((chunk = state->next++) < n_chunks) {
+            std::size_t begin = first + chunk * grain;
+            fn(begin, std::min(last, begin + grain));
+            if (++state->n_done == n_chunks) {
+                std::lock_guard lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    std::size_t n_helpers = std::min(pool.size(), n_chunks - 1);
+    for (std::size_t i = 0; i < n_helpers; ++i) {
+        pool.submit(run_chunks, TaskPool::urgent);
+    }
+    run_chunks();
+
+    std::unique_lock lock(state->mutex);
+    state->done.wait(lock, [&] { return state->n_done == n_chunks; });
+}
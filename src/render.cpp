@@ -0,0 +1,923 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <latch>
+#include <limits>
+#include <memory>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "buddhabrot.h"
+#include "cmap.h"
+#include "dispatch.h"
+#include "double_double.h"
+#include "formula.h"
+#include "frames.h"
+#include "image.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "render.h"
+#include "seeds.h"
+#include "strips.h"
+
+void print_duration(std::ostream& os, float secs)
+{
+    int whole_secs = std::lround(secs);
+    int mins = whole_secs / 60;
+    int mod_secs = whole_secs % 60;
+
+    os << std::setfill('0') << std::setw(2) << mins << ":";
+    os << std::setfill('0') << std::setw(2) << mod_secs;
+}
+
+void print_progress(std::uint64_t progress, std::uint64_t max_progress, std::chrono::duration<float> elapsed)
+{
+    std::uint64_t width = 32;
+
+    std::string csi = "\033[";
+    std::cout << csi << "1K" << csi << "G";
+
+    std::vector<std::string> eighths {
+        " ",
+        "▏",
+        "▎",
+        "▍",
+        "▌",
+        "▋",
+        "▊",
+        "▊",
+        "█"
+    };
+
+    int whole = (width * progress) / max_progress;
+    int part = (8 * width * progress) / max_progress - 8 * whole;
+
+    std::cout << "[";
+    for (int i = 0; i < whole; ++i) {
+        std::cout << eighths.back();
+    }
+
+    if (progress != max_progress) {
+        std::cout << eighths[part] << std::string(width - whole - 1, ' ');
+    }
+
+    float ratio = static_cast<float>(progress) / max_progress;
+    std::cout << "] " << std::fixed << std::setprecision(1) << (100.0f * ratio) << "%";
+
+    std::cout << "(";
+    float estimate = elapsed.count() / ratio;
+    print_duration(std::cout, elapsed.count());
+    std::cout << "/";
+    if (elapsed.count() < 2.0f) {
+        std::cout << "--:--";
+    } else {
+        print_duration(std::cout, estimate);
+    }
+    std::cout << ")";
+
+    std::cout.flush();
+}
+
+namespace {
+
+// Samples per sampling task; a stream of points_per_thread samples runs as a
+// chain of such tasks.
+constexpr std::uint64_t stream_chunk = 1 << 14;
+
+OrbitMode parse_orbit_mode(const std::string& name)
+{
+    if (name == "store") {
+        return OrbitMode::store;
+    } else if (name == "recompute") {
+        return OrbitMode::recompute;
+    } else if (name == "auto") {
+        return OrbitMode::adaptive;
+    }
+
+    throw std::invalid_argument("Invalid orbit mode " + name);
+}
+
+template <typename T, Formula F>
+std::vector<std::uint64_t> sample_with(const RenderConfig& config, const std::vector<std::pair<float, float>>& good_points, RenderStats& stats, SampleOutputs* outputs, RowRange rows, RenderControl* control, PendingSeeds* pending)
+{
+    std::size_t n_threads = config.n_threads;
+
+    // Frames and Nebulabrot channels are sums of elementary bands, each
+    // orbit is splatted into the one band its length falls in, and the pass
+    // iterates up to the longest window.
+    std::vector<IterWindow> windows = iter_windows(config);
+    std::vector<std::uint64_t> edges = band_edges(windows);
+    std::uint64_t max_iter = windows.empty() ? config.max_iter : edges.back() - 1;
+    std::size_t n_bands = windows.empty() ? 1 : edges.size() - 1;
+
+    std::uint64_t width = image_width(config);
+    std::uint64_t height = image_height(config);
+    if (width < 2 || height < 2) {
+        throw std::invalid_argument("Output must be at least 2x2 pixels");
+    }
+    if (!(config.re_min < config.re_max && config.im_min < config.im_max)) {
+        throw std::invalid_argument("Invalid viewport");
+    }
+    if (rows.end != 0 && (rows.begin >= rows.end || rows.end > height)) {
+        throw std::invalid_argument("Invalid row range");
+    }
+    std::uint64_t n_rows = rows.end != 0 ? rows.end - rows.begin : height;
+
+    BuddhabrotThread<T, F> buddha_template {
+        .view = kernels::PixelMap<T>::make(config.re_min, config.re_max, config.im_min, config.im_max, width, height, conjugate_symmetric(F)),
+        .max_iter = max_iter,
+        .counts = TiledHistogram(width * n_rows * n_bands),
+        .p_uniform = config.p_uniform,
+        .good_points = good_points,
+        .point_radius = config.box_scale * 2.0f / config.size,
+        .progress = 0,
+    };
+
+    std::uint64_t points_per_thread = config.points_per_thread;
+
+    if (!config.quiet) {
+        std::cout << "Sampling Buddhabrot data...\n";
+    }
+    // The prefilter drops bounded orbits before there is a double precision
+    // z to look for a cycle from, so it is off for anti-Buddhabrot renders.
+    bool with_anti = outputs != nullptr && !config.anti_output.empty();
+    buddha_template.prefilter = config.prefilter && !std::is_same_v<T, float> && !with_anti;
+    buddha_template.prefilter_guard = config.prefilter_guard;
+    buddha_template.specialize = config.specialize;
+    buddha_template.orbit_mode = parse_orbit_mode(config.orbit_mode);
+    buddha_template.recompute_threshold = config.recompute_threshold;
+    buddha_template.band_edges = edges;
+    buddha_template.row_begin = rows.begin;
+    buddha_template.row_end = rows.end;
+    buddha_template.cancelled = control != nullptr ? &control->cancelled : nullptr;
+    buddha_template.pending_seeds = pending;
+    if (outputs != nullptr) {
+        for (const auto& target : config.targets) {
+            if (target.width < 2 || target.height < 2 || !(target.re_min < target.re_max && target.im_min < target.im_max)) {
+                throw std::invalid_argument("Invalid target " + target.output);
+            }
+            buddha_template.targets.push_back({ .view = kernels::PixelMap<T>::make(target.re_min, target.re_max, target.im_min, target.im_max, target.width, target.height, conjugate_symmetric(F)) });
+        }
+    }
+
+    // In pipelined mode the n_threads sampling threads become finders, which
+    // need no histogram of their own.
+    bool pipelined = config.n_splatters > 0;
+    BuddhabrotThread<T, F> splatter_template = buddha_template;
+    if (with_anti) {
+        buddha_template.anti_counts = TiledHistogram(width * height);
+    }
+    if (pipelined) {
+        buddha_template.counts = {};
+    }
+
+    // Replay splats recorded escaping seeds instead of drawing samples; the
+    // seeds are sorted by orbit length, so only the range the bands or
+    // max_iter can use is loaded into the threads.
+    bool replaying = !config.replay_seeds.empty();
+    SeedDatabase db;
+    std::pair<const EscapeSeed*, const EscapeSeed*> replay_range;
+    if (replaying) {
+        // The database holds escaping seeds only, so there are no bounded
+        // orbits for an anti-Buddhabrot.
+        if (pipelined || !config.record_seeds.empty() || !config.anti_output.empty()) {
+            throw std::invalid_argument("Seed replay can't be combined with --splatters, --record-seeds or --anti");
+        }
+        db = read_seeds(config.replay_seeds);
+        if (db.formula != F) {
+            throw std::invalid_argument("Seeds in " + config.replay_seeds + " were recorded for formula " + formula_name(db.formula));
+        }
+        if (max_iter > db.max_iter) {
+            throw std::invalid_argument("Seeds in " + config.replay_seeds + " were recorded with max_iter " + std::to_string(db.max_iter));
+        }
+        replay_range = seed_range(db, windows.empty() ? 0 : edges.front(), max_iter);
+    }
+    std::size_t n_replay = replay_range.second - replay_range.first;
+    std::uint64_t total_points = replaying ? n_replay : points_per_thread * n_threads;
+    buddha_template.record_seeds = !config.record_seeds.empty();
+
+    std::vector buddha_threads(n_threads, buddha_template);
+    if (config.seed != 0) {
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            buddha_threads[i].seed = config.seed + i;
+        }
+    }
+
+    // Sampling streams and the merge are pool tasks at the render's priority,
+    // on the control's pool or the default one. Each stream runs as a chain
+    // of stream_chunk sample tasks, the next submitted when one finishes, so
+    // priorities and stealing act between chunks rather than whole streams.
+    // Replay streams run as one task each. Pipeline finders and splatters
+    // wait on each other, so they always get threads of their own.
+    TaskPool* pool = pipelined ? nullptr : control != nullptr && control->pool != nullptr ? control->pool : &default_pool();
+    int priority = control != nullptr ? control->priority : 0;
+    std::latch streams_done(pipelined ? 0 : n_threads);
+
+    std::function<void(std::size_t)> run_chunk = [&](std::size_t i) {
+        if (buddha_threads[i].sample(points_per_thread, stream_chunk)) {
+            streams_done.count_down();
+        } else {
+            pool->submit([&run_chunk, i] { run_chunk(i); }, priority);
+        }
+    };
+
+    std::unique_ptr<SamplePipeline<T, F>> pipeline;
+    auto start = std::chrono::steady_clock::now();
+    if (pipelined) {
+        pipeline = std::make_unique<SamplePipeline<T, F>>(buddha_threads, splatter_template, config.n_splatters, config.ring_capacity);
+        pipeline->start(points_per_thread);
+    } else {
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            if (replaying) {
+                std::size_t n_seeds = i < n_replay ? n_replay - i : 0;
+                pool->submit([&, i, n_seeds] {
+                    buddha_threads[i].replay(replay_range.first + i, n_seeds, n_threads);
+                    streams_done.count_down();
+                }, priority);
+            } else {
+                pool->submit([&run_chunk, i] { run_chunk(i); }, priority);
+            }
+        }
+    }
+
+    if (control != nullptr) {
+        control->total = total_points;
+    }
+    // The caller may itself be a pool task, so rather than block while the
+    // streams run it runs queued tasks of the render's priority or above,
+    // like parallel_for's caller runs chunks.
+    auto help_for = [&](std::chrono::steady_clock::duration duration) {
+        auto until = std::chrono::steady_clock::now() + duration;
+        while (std::chrono::steady_clock::now() < until) {
+            if (pool == nullptr || !pool->run_one(priority)) {
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(std::chrono::milliseconds(1), until - std::chrono::steady_clock::now()));
+            }
+        }
+    };
+
+    // Cancelled threads report all their points as done, so the loop ends.
+    bool done = config.quiet && control == nullptr;
+    while (!done) {
+        using namespace std::chrono_literals;
+
+        std::uint64_t total_progress = 0;
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            total_progress += buddha_threads[i].progress.load();
+        }
+
+        if (control != nullptr) {
+            control->progress = total_progress;
+            // A stream may be running the seed pass's chunks, which have to
+            // stop before the streams can.
+            if (control->cancelled && pending != nullptr) {
+                pending->stop = true;
+            }
+        }
+        if (!config.quiet) {
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<float> elapsed = now - start;
+            print_progress(total_progress, total_points, elapsed);
+        }
+        help_for(config.quiet ? 5ms : 100ms);
+
+        done = (total_progress >= total_points);
+    }
+
+    if (pipelined) {
+        pipeline->join();
+    } else {
+        while (!streams_done.try_wait()) {
+            help_for(std::chrono::milliseconds(1));
+        }
+    }
+    auto sampled = std::chrono::steady_clock::now();
+    if (control != nullptr && control->cancelled) {
+        throw RenderCancelled();
+    }
+
+    if (!config.quiet) {
+        std::cout << "\nMerging thread results ... ";
+        std::cout.flush();
+    }
+    std::vector<std::uint64_t> result = pipelined ? merge_results(pipeline->results()) : merge_results(buddha_threads, *pool);
+    if (with_anti) {
+        outputs->anti = merge_results(buddha_threads, *pool, &BuddhabrotThread<T, F>::anti_counts);
+    }
+    if (outputs != nullptr) {
+        outputs->targets.clear();
+        stats.target_hits.assign(config.targets.size(), 0);
+        stats.target_dense.assign(config.targets.size(), 0);
+        for (std::size_t t = 0; t < config.targets.size(); ++t) {
+            outputs->targets.emplace_back(config.targets[t].width * config.targets[t].height);
+            for (const auto& thread : pipelined ? pipeline->results() : buddha_threads) {
+                thread.targets[t].add_to(outputs->targets[t]);
+                stats.target_hits[t] += thread.targets[t].n_hits;
+                stats.target_dense[t] += thread.targets[t].is_dense();
+            }
+        }
+    }
+    if (!config.quiet) {
+        std::cout << "done\n";
+    }
+    auto merged = std::chrono::steady_clock::now();
+
+    stats.n_samples = total_points;
+    stats.n_bands = n_bands;
+    if (replaying) {
+        stats.n_replay_samples = db.n_samples;
+        stats.n_replay_seeds = db.seeds.size();
+    }
+    if (!config.record_seeds.empty()) {
+        SeedDatabase recorded { F, max_iter, total_points, {} };
+        for (auto& thread : buddha_threads) {
+            recorded.seeds.insert(recorded.seeds.end(), thread.seeds.begin(), thread.seeds.end());
+            thread.seeds = {};
+        }
+        write_seeds(config.record_seeds, recorded);
+        stats.n_recorded = recorded.seeds.size();
+    }
+    for (const auto& thread : buddha_threads) {
+        stats.n_prefiltered += thread.n_prefiltered;
+        stats.n_guarded += thread.n_guarded;
+        stats.n_escaped += thread.n_escaped;
+        stats.n_recomputed += thread.n_recomputed;
+        stats.n_unseeded += thread.n_unseeded;
+        stats.n_orbit_points += thread.n_orbit_points;
+        stats.n_splatted += thread.n_splatted;
+        stats.n_outside += thread.n_outside;
+        stats.n_cycles += thread.n_cycles;
+        stats.n_aperiodic += thread.n_aperiodic;
+    }
+    for (const auto& thread : pipelined ? pipeline->results() : buddha_threads) {
+        stats.n_tiles += thread.counts.n_tiles();
+        stats.n_tiles_touched += thread.counts.n_touched();
+    }
+    for (const auto& thread : buddha_threads) {
+        stats.n_tiles += thread.anti_counts.n_tiles();
+        stats.n_tiles_touched += thread.anti_counts.n_touched();
+    }
+    if (pipelined) {
+        stats.pipeline = pipeline->stats();
+        for (const auto& splatter : pipeline->results()) {
+            stats.n_orbit_points += splatter.n_orbit_points;
+            stats.n_splatted += splatter.n_splatted;
+        }
+    }
+    stats.sample_seconds = std::chrono::duration<double>(sampled - start).count();
+    stats.merge_seconds = std::chrono::duration<double>(merged - sampled).count();
+
+    return result;
+}
+
+}
+
+std::vector<IterWindow> iter_windows(const RenderConfig& config)
+{
+    std::vector<IterWindow> frames = config.frames;
+    if (config.sweep.n_frames > 0) {
+        std::vector<IterWindow> sweep = sweep_windows(config.sweep.lower_end, config.sweep.from, config.sweep.to, config.sweep.n_frames, config.sweep.lower_end ? config.max_iter : 0);
+        frames.insert(frames.end(), sweep.begin(), sweep.end());
+    }
+    if (!config.bands.empty() && !frames.empty()) {
+        throw std::invalid_argument("Bands and frames can't be combined");
+    }
+    if (config.bands.size() > 3) {
+        throw std::invalid_argument("At most 3 bands are supported");
+    }
+
+    std::vector<IterWindow> windows = config.bands.empty() ? frames : config.bands;
+    for (auto [first, second] : windows) {
+        if (first > second) {
+            throw std::invalid_argument("Invalid orbit length window " + std::to_string(first) + ":" + std::to_string(second));
+        }
+    }
+
+    return windows;
+}
+
+std::uint64_t image_width(const RenderConfig& config)
+{
+    return config.width != 0 ? config.width : config.size;
+}
+
+std::uint64_t image_height(const RenderConfig& config)
+{
+    return config.height != 0 ? config.height : config.size;
+}
+
+std::vector<std::uint64_t> sample_buddhabrot(const RenderConfig& config, const std::vector<std::pair<float, float>>& good_points, RenderStats& stats, SampleOutputs* outputs, RowRange rows, RenderControl* control, PendingSeeds* pending)
+{
+    return with_formula(parse_formula(config.formula), [&](auto formula) {
+        constexpr Formula F = decltype(formula)::value;
+        if (config.precision == "double") {
+            return sample_with<double, F>(config, good_points, stats, outputs, rows, control, pending);
+        } else if (config.precision == "float") {
+            return sample_with<float, F>(config, good_points, stats, outputs, rows, control, pending);
+        } else if (config.precision == "double-double") {
+            return sample_with<DoubleDouble, F>(config, good_points, stats, outputs, rows, control, pending);
+        }
+
+        throw std::invalid_argument("Invalid precision " + config.precision);
+    });
+}
+
+std::vector<float> log_image(const std::vector<std::uint64_t>& counts)
+{
+    std::vector<float> result(counts.size());
+    parallel_for(0, counts.size(), 1 << 16, [&](std::size_t begin, std::size_t end) {
+        active_kernels().log_counts(counts.data() + begin, end - begin, result.data() + begin);
+    });
+
+    return result;
+}
+
+namespace {
+
+// Version 1 files hold square histograms and end the header before height.
+const char histogram_magic_v1[8] = { 'B', 'B', 'H', 'I', 'S', 'T', '1', '\0' };
+const char histogram_magic[8] = { 'B', 'B', 'H', 'I', 'S', 'T', '2', '\0' };
+
+struct HistogramHeader {
+    char magic[8];
+    std::uint64_t width;
+    std::uint64_t max_iter;
+    std::uint64_t n_samples;
+    std::uint64_t height;
+};
+
+constexpr std::size_t histogram_header_v1_size = offsetof(HistogramHeader, height);
+
+}
+
+void write_histogram(const std::string& filename, const std::vector<std::uint64_t>& counts, std::uint64_t width, std::uint64_t height, std::uint64_t max_iter, std::uint64_t n_samples)
+{
+    HistogramHeader header {};
+    std::copy(std::begin(histogram_magic), std::end(histogram_magic), header.magic);
+    header.width = width;
+    header.height = height;
+    header.max_iter = max_iter;
+    header.n_samples = n_samples;
+
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(std::uint64_t));
+    if (!ofs) {
+        throw std::runtime_error("Failed to write histogram " + filename);
+    }
+}
+
+std::vector<std::uint64_t> read_histogram(const std::string& filename, std::uint64_t width, std::uint64_t height, std::uint64_t max_iter, std::uint64_t& n_samples)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    HistogramHeader header {};
+    if (!ifs.read(reinterpret_cast<char*>(&header), histogram_header_v1_size)) {
+        throw std::runtime_error("Not a histogram file: " + filename);
+    }
+    if (std::equal(std::begin(histogram_magic_v1), std::end(histogram_magic_v1), header.magic)) {
+        header.height = header.width;
+    } else if (!std::equal(std::begin(histogram_magic), std::end(histogram_magic), header.magic)
+               || !ifs.read(reinterpret_cast<char*>(&header.height), sizeof(header.height))) {
+        throw std::runtime_error("Not a histogram file: " + filename);
+    }
+    if (header.width != width || header.height != height || header.max_iter != max_iter) {
+        throw std::runtime_error("Histogram " + filename + " has different dimensions or max_iter");
+    }
+
+    std::vector<std::uint64_t> counts(width * height);
+    if (!ifs.read(reinterpret_cast<char*>(counts.data()), counts.size() * sizeof(std::uint64_t))) {
+        throw std::runtime_error("Truncated histogram " + filename);
+    }
+    // A file holding several band planes is not a single histogram.
+    if (ifs.peek() != std::ifstream::traits_type::eof()) {
+        throw std::runtime_error("Histogram " + filename + " has more than one plane");
+    }
+    n_samples = header.n_samples;
+
+    return counts;
+}
+
+namespace {
+
+std::vector<std::uint8_t> tone_map_rows(const std::vector<float>& log_image, std::uint64_t width, const std::string& cmap_name, float vmin, float vmax)
+{
+    const auto& table = Colormap<float>::by_name(cmap_name).table();
+
+    std::vector<std::uint8_t> rgb(3 * log_image.size());
+    parallel_for(0, log_image.size() / width, 16, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t y = begin; y < end; ++y) {
+            active_kernels().tone_map(&log_image[y * width], width, table.front().data(), table.size(), vmin, vmax, &rgb[3 * y * width]);
+        }
+    });
+
+    return rgb;
+}
+
+void write_ppm_header(std::ostream& os, std::uint64_t width, std::uint64_t height)
+{
+    os << "P3\n";
+    os << width << " " << height << "\n";
+    os << "255\n";
+}
+
+// Writes each channel value followed by a space, formatting chunks of the
+// image in parallel and writing them in order.
+void write_ppm_values(std::ostream& os, std::span<const std::uint8_t> rgb)
+{
+    std::size_t grain = 1 << 18;
+    std::vector<std::string> chunks((rgb.size() + grain - 1) / grain);
+    parallel_for(0, rgb.size(), grain, [&](std::size_t begin, std::size_t end) {
+        std::string& text = chunks[begin / grain];
+        text.resize(4 * (end - begin));
+        char* out = text.data();
+        for (std::size_t i = begin; i < end; ++i) {
+            out = std::to_chars(out, text.data() + text.size(), rgb[i]).ptr;
+            *out++ = ' ';
+        }
+        text.resize(out - text.data());
+    });
+
+    for (const auto& text : chunks) {
+        os << text;
+    }
+}
+
+}
+
+std::vector<std::uint8_t> tone_map_image(const std::vector<std::uint64_t>& counts, std::uint64_t width, const std::string& cmap_name)
+{
+    std::vector<float> log_image = ::log_image(counts);
+    auto [vmin, vmax] = std::minmax_element(log_image.begin(), log_image.end());
+
+    return tone_map_rows(log_image, width, cmap_name, *vmin, *vmax);
+}
+
+std::vector<std::uint8_t> nebula_image(const std::vector<std::vector<std::uint64_t>>& channels)
+{
+    std::vector<std::uint8_t> rgb(3 * channels.front().size());
+
+    for (std::size_t ch = 0; ch < channels.size(); ++ch) {
+        std::vector<float> log_image = ::log_image(channels[ch]);
+        auto [vmin, vmax] = std::minmax_element(log_image.begin(), log_image.end());
+        float range = std::max(*vmax - *vmin, std::numeric_limits<float>::min());
+        parallel_for(0, log_image.size(), 1 << 16, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                float t = (log_image[i] - *vmin) / range;
+                rgb[3 * i + ch] = static_cast<std::uint8_t>(std::min(255, static_cast<int>(256 * t)));
+            }
+        });
+    }
+
+    return rgb;
+}
+
+void write_ppm(const Image& image)
+{
+    std::ofstream ofs(image.output);
+    write_ppm_header(ofs, image.width, image.height);
+    write_ppm_values(ofs, image.rgb);
+}
+
+void write_image(const std::string& filename, const std::vector<std::uint64_t>& counts, std::uint64_t width, std::uint64_t height, const std::string& cmap_name)
+{
+    write_ppm({ filename, width, height, tone_map_image(counts, width, cmap_name) });
+}
+
+void write_image(const std::string& filename, HistogramFile& histogram, std::uint64_t strip_rows, float vmin, float vmax, const std::string& cmap_name)
+{
+    std::ofstream ofs(filename);
+    write_ppm_header(ofs, histogram.width(), histogram.height());
+    for (std::uint64_t row = 0; row < histogram.height(); row += strip_rows) {
+        std::uint64_t n_rows = std::min(strip_rows, histogram.height() - row);
+        std::vector<std::uint8_t> rgb = tone_map_rows(log_image(histogram.read(row, n_rows)), histogram.width(), cmap_name, vmin, vmax);
+        write_ppm_values(ofs, rgb);
+    }
+}
+
+std::uint64_t strip_height(const RenderConfig& config)
+{
+    std::vector<IterWindow> windows = iter_windows(config);
+    std::uint64_t n_planes = windows.empty() ? 1 : band_edges(windows).size() - 1;
+    // The sampling threads' (or splatters') histograms plus the merged one.
+    std::uint64_t n_histograms = (config.n_splatters > 0 ? config.n_splatters : config.n_threads) + 1;
+
+    return strip_height(image_width(config), image_height(config), n_histograms * n_planes, config.memory_limit);
+}
+
+namespace {
+
+// Replayed seeds and purely uniform sampling need no seed mask.
+bool needs_seeds(const RenderConfig& config)
+{
+    return config.replay_seeds.empty() && config.p_uniform < 1.0f;
+}
+
+// The seed pass runs in the background while sampling starts uniformly when
+// some samples are uniform anyway. A fixed seed keeps the sequential order,
+// since when the seeds arrive changes which samples are drawn.
+bool overlap_seeds(const RenderConfig& config)
+{
+    return needs_seeds(config) && config.p_uniform > 0.0f && config.seed == 0;
+}
+
+std::vector<std::pair<float, float>> seed_points(const RenderConfig& config, const std::atomic<bool>* cancelled = nullptr)
+{
+    if (!needs_seeds(config)) {
+        return {};
+    }
+
+    auto points = find_good_points(config.size, config.seed_max_iter, config.n_dilations, !config.quiet, parse_formula(config.formula), cancelled);
+    if (cancelled != nullptr && *cancelled) {
+        throw RenderCancelled();
+    }
+
+    return points;
+}
+
+// Out-of-core render: one sampling pass per strip of rows, all with the same
+// seeds, each strip appended to a histogram file next to the output that the
+// image is then streamed from.
+RenderStats render_strips(const RenderConfig& base, const std::vector<std::pair<float, float>>& good_points, std::uint64_t strip_rows)
+{
+    if (!iter_windows(base).empty() || !base.anti_output.empty() || !base.targets.empty() || !base.record_seeds.empty()) {
+        throw std::invalid_argument("Out-of-core renders can't be combined with bands, frames, --anti, --target or --record-seeds");
+    }
+
+    RenderConfig config = base;
+    std::random_device rd;
+    while (config.seed == 0) {
+        config.seed = rd();
+    }
+
+    std::uint64_t width = image_width(config);
+    std::uint64_t height = image_height(config);
+    HistogramFile histogram(config.output + ".counts", width, height);
+    float vmin = std::numeric_limits<float>::max();
+    float vmax = std::numeric_limits<float>::lowest();
+
+    RenderStats stats;
+    for (std::uint64_t row = 0; row < height; row += strip_rows) {
+        RowRange rows { row, std::min(height, row + strip_rows) };
+        if (!config.quiet) {
+            std::cout << "Strip " << stats.n_strips << ": rows " << rows.begin << " to " << rows.end - 1 << " of " << height << "\n";
+        }
+
+        RenderStats pass;
+        std::vector<std::uint64_t> counts = sample_buddhabrot(config, good_points, pass, nullptr, rows);
+        std::vector<float> log_strip = log_image(counts);
+        auto [lo, hi] = std::minmax_element(log_strip.begin(), log_strip.end());
+        vmin = std::min(vmin, *lo);
+        vmax = std::max(vmax, *hi);
+        histogram.append(counts);
+
+        // Every pass draws the same samples, so only times and splats add up.
+        if (row == 0) {
+            stats = pass;
+            stats.n_strips = 0;
+            stats.n_outside = 0;
+        } else {
+            stats.sample_seconds += pass.sample_seconds;
+            stats.merge_seconds += pass.merge_seconds;
+            stats.n_splatted += pass.n_splatted;
+        }
+        ++stats.n_strips;
+    }
+    stats.strip_rows = strip_rows;
+
+    if (!config.quiet) {
+        std::cout << "Writing image ... ";
+        std::cout.flush();
+    }
+    write_image(config.output, histogram, strip_rows, vmin, vmax, config.cmap);
+    if (!config.quiet) {
+        std::cout << "done\n";
+    }
+
+    return stats;
+}
+
+}
+
+std::shared_ptr<const SeedCache::Points> SeedCache::get(const RenderConfig& config, const std::atomic<bool>* cancelled)
+{
+    if (!needs_seeds(config)) {
+        return std::make_shared<const Points>();
+    }
+
+    Key key { config.size, config.seed_max_iter, config.n_dilations, parse_formula(config.formula) };
+    while (true) {
+        std::promise<std::shared_ptr<const Points>> promise;
+        std::shared_future<std::shared_ptr<const Points>> points;
+        std::uint64_t id = 0;
+        {
+            std::lock_guard lock(mutex);
+            auto it = entries.find(key);
+            if (it == entries.end()) {
+                if (entries.size() == capacity) {
+                    entries.erase(std::min_element(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.second.last_use < b.second.last_use; }));
+                }
+                id = ++n_entries;
+                it = entries.emplace(key, Entry { promise.get_future().share(), 0, id }).first;
+            }
+            it->second.last_use = ++n_uses;
+            points = it->second.points;
+        }
+
+        // The render that created the entry computes the mask. A failed
+        // computation leaves the cache, so it is neither reused nor stuck.
+        if (id != 0) {
+            try {
+                promise.set_value(std::make_shared<const Points>(seed_points(config, cancelled)));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+                std::lock_guard lock(mutex);
+                auto it = entries.find(key);
+                if (it != entries.end() && it->second.id == id) {
+                    entries.erase(it);
+                }
+            }
+        }
+
+        using namespace std::chrono_literals;
+        while (points.wait_for(5ms) != std::future_status::ready) {
+            if (cancelled != nullptr && *cancelled) {
+                throw RenderCancelled();
+            }
+        }
+        try {
+            return points.get();
+        } catch (const RenderCancelled&) {
+            // Another render gave up on the mask; compute it anew unless this
+            // one is cancelled too.
+            if (id != 0 || (cancelled != nullptr && *cancelled)) {
+                throw;
+            }
+        }
+    }
+}
+
+namespace {
+
+// Seed pass running as a pool task, its points published to pending() once
+// ready. compute gets pending().stop, which the sampler sets when the render
+// is cancelled and finish() or destruction sets to abandon the pass. A kept
+// pass, whose mask goes into a seed cache, is worth completing after sampling
+// and instead gets the render's cancelled flag, so only cancelling stops it.
+class BackgroundSeeds {
+public:
+    BackgroundSeeds(TaskPool& pool, const std::atomic<bool>* cancelled, bool keep, std::function<std::shared_ptr<const SeedCache::Points>(const std::atomic<bool>*)> compute)
+        : keep(keep)
+    {
+        pending_seeds.pool = &pool;
+        const std::atomic<bool>* stop = keep ? cancelled : &pending_seeds.stop;
+        pool.submit([this, stop, compute = std::move(compute)] {
+            try {
+                points = compute(stop);
+                pending_seeds.points.store(points.get(), std::memory_order_release);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            done.count_down();
+        }, TaskPool::urgent);
+    }
+
+    ~BackgroundSeeds()
+    {
+        pending_seeds.stop = true;
+        done.wait();
+    }
+
+    PendingSeeds& pending()
+    {
+        return pending_seeds;
+    }
+
+    // Called once sampling has returned. Sampling no longer needs the
+    // points, so unless the pass is kept it is stopped and its result
+    // dropped. Rethrows the seed pass's error, if any, other than the
+    // cancellation caused by stopping it.
+    void finish()
+    {
+        if (!keep) {
+            pending_seeds.stop = true;
+        }
+        done.wait();
+        if (!error) {
+            return;
+        }
+        try {
+            std::rethrow_exception(error);
+        } catch (const RenderCancelled&) {
+            if (keep) {
+                throw;
+            }
+        }
+    }
+
+private:
+    bool keep;
+    PendingSeeds pending_seeds;
+    std::shared_ptr<const SeedCache::Points> points;
+    std::exception_ptr error;
+    std::latch done { 1 };
+};
+
+}
+
+RenderResult render_result(const RenderConfig& config, RenderControl* control, SeedCache* seeds)
+{
+    if (strip_height(config) < image_height(config)) {
+        throw std::invalid_argument("Out-of-core renders can only be written to files");
+    }
+
+    RenderResult result;
+    SampleOutputs outputs;
+    const std::atomic<bool>* cancelled = control != nullptr ? &control->cancelled : nullptr;
+    if (overlap_seeds(config)) {
+        // The background pass prints nothing, as the progress bar is running.
+        // Streams waiting for its points run its chunks first, so the points
+        // arrive no later than from a seed pass ahead of sampling.
+        RenderConfig silent = config;
+        silent.quiet = true;
+        TaskPool& pool = control != nullptr && control->pool != nullptr ? *control->pool : default_pool();
+        // A render that finishes first has no use for the points, but a mask
+        // going into the seed cache is completed for later renders.
+        BackgroundSeeds background(pool, cancelled, seeds != nullptr, [silent, seeds](const std::atomic<bool>* stop) {
+            return seeds != nullptr ? seeds->get(silent, stop) : std::make_shared<const SeedCache::Points>(seed_points(silent, stop));
+        });
+        result.counts = sample_buddhabrot(config, {}, result.stats, &outputs, {}, control, &background.pending());
+        background.finish();
+    } else {
+        auto good_points = seeds != nullptr ? seeds->get(config, cancelled) : std::make_shared<const SeedCache::Points>(seed_points(config, cancelled));
+        result.counts = sample_buddhabrot(config, *good_points, result.stats, &outputs, {}, control);
+    }
+
+    std::uint64_t width = image_width(config);
+    std::uint64_t height = image_height(config);
+    result.width = width;
+    result.height = height;
+    std::vector<IterWindow> windows = iter_windows(config);
+    if (windows.empty()) {
+        result.images.push_back({ config.output, width, height, tone_map_image(result.counts, width, config.cmap) });
+    } else {
+        // Every window is now one or two planes of the running sums.
+        std::vector<std::uint64_t> edges = band_edges(windows);
+        accumulate_bands(result.counts, width * height);
+        if (!config.bands.empty()) {
+            std::vector<std::vector<std::uint64_t>> channels;
+            for (const auto& band : windows) {
+                channels.push_back(window_counts(result.counts, edges, band, width * height));
+            }
+            result.images.push_back({ config.output, width, height, nebula_image(channels) });
+        } else {
+            for (std::size_t k = 0; k < windows.size(); ++k) {
+                result.images.push_back({ frame_filename(config.output, k), width, height, tone_map_image(window_counts(result.counts, edges, windows[k], width * height), width, config.cmap) });
+            }
+        }
+    }
+    if (!config.anti_output.empty()) {
+        result.images.push_back({ config.anti_output, width, height, tone_map_image(outputs.anti, width, config.cmap) });
+    }
+    for (std::size_t t = 0; t < config.targets.size(); ++t) {
+        const RenderTarget& target = config.targets[t];
+        result.images.push_back({ target.output, target.width, target.height, tone_map_image(outputs.targets[t], target.width, config.cmap) });
+    }
+
+    return result;
+}
+
+RenderStats render(const RenderConfig& config)
+{
+    std::uint64_t strip_rows = strip_height(config);
+    if (strip_rows < image_height(config)) {
+        return render_strips(config, seed_points(config), strip_rows);
+    }
+
+    RenderResult result = render_result(config);
+
+    if (!config.quiet) {
+        std::cout << "Writing image ... ";
+        std::cout.flush();
+    }
+    for (const Image& image : result.images) {
+        write_ppm(image);
+    }
+    if (!config.quiet) {
+        std::cout << "done\n";
+    }
+
+    return result.stats;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "double_double.h"
+#include "formula.h"
+#include "frames.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "strips.h"
+
+// Extra viewport rendered from the same orbits as the main image.
+struct RenderTarget {
+    DoubleDouble re_min;
+    DoubleDouble re_max;
+    DoubleDouble im_min;
+    DoubleDouble im_max;
+    std::uint64_t width;
+    std::uint64_t height;
+    std::string output;
+};
+
+// Frame sequence whose lower (lower_end) or upper orbit length bound steps
+// from from to to over n_frames frames. The other bound stays at max_iter or
+// 0.
+struct FrameSweep {
+    bool lower_end = false;
+    std::uint64_t from = 0;
+    std::uint64_t to = 0;
+    std::size_t n_frames = 0;
+};
+
+// Pixel rows [begin, end) of the output that one out-of-core pass samples;
+// end == 0 stands for all rows.
+struct RowRange {
+    std::uint64_t begin = 0;
+    std::uint64_t end = 0;
+};
+
+struct RenderConfig {
+    std::uint64_t size = 4096;
+    std::uint64_t width = 0;
+    std::uint64_t height = 0;
+    // Viewport bounds keep double-double precision for deep zooms.
+    DoubleDouble re_min = -2.0;
+    DoubleDouble re_max = 2.0;
+    DoubleDouble im_min = -2.0;
+    DoubleDouble im_max = 2.0;
+    std::uint64_t max_iter = 20;
+    std::uint64_t seed_max_iter = 1000;
+    std::uint64_t n_dilations = 2;
+    std::size_t n_threads = 12;
+    std::uint64_t points_per_thread = 100000000;
+    float p_uniform = 1.0f;
+    float box_scale = 1.0f;
+    std::string precision = "double";
+    std::string formula = "mandelbrot";
+    std::uint64_t seed = 0;
+    std::string isa = "auto";
+    // Size (0 for one worker per hardware thread) and pinning of the
+    // process-wide pool, which only the first render of a process sets up.
+    std::size_t n_workers = 0;
+    bool pin_workers = false;
+    bool prefilter = false;
+    bool specialize = true;
+    float prefilter_guard = 0.05f;
+    std::string orbit_mode = "auto";
+    std::uint64_t recompute_threshold = 10000;
+    std::size_t n_splatters = 0;
+    std::size_t ring_capacity = 4096;
+    std::vector<IterWindow> bands;
+    std::vector<IterWindow> frames;
+    FrameSweep sweep;
+    std::string anti_output;
+    std::vector<RenderTarget> targets;
+    std::string record_seeds;
+    std::string replay_seeds;
+    // Bytes all histograms of a pass may take, 0 for no limit. Larger images
+    // are rendered in horizontal strips, one sampling pass each.
+    std::uint64_t memory_limit = 0;
+    std::string cmap = "mako";
+    std::string output = "out20.ppm";
+    bool quiet = false;
+};
+
+struct RenderStats {
+    std::uint64_t n_samples = 0;
+    double sample_seconds = 0.0;
+    double merge_seconds = 0.0;
+    std::uint64_t n_prefiltered = 0;
+    std::uint64_t n_guarded = 0;
+    std::uint64_t n_escaped = 0;
+    std::uint64_t n_recomputed = 0;
+    // Uniform samples drawn while the seed points were still computed.
+    std::uint64_t n_unseeded = 0;
+    std::uint64_t n_orbit_points = 0;
+    std::uint64_t n_splatted = 0;
+    std::uint64_t n_outside = 0;
+    std::uint64_t n_cycles = 0;
+    std::uint64_t n_aperiodic = 0;
+    PipelineStats pipeline;
+    std::uint64_t n_recorded = 0;
+    std::uint64_t n_replay_seeds = 0;
+    std::uint64_t n_replay_samples = 0;
+    std::size_t n_bands = 1;
+    // Histogram tiles over all sampling (or splatter) threads, anti-Buddhabrot
+    // ones included, and how many of them were touched and allocated.
+    std::uint64_t n_tiles = 0;
+    std::uint64_t n_tiles_touched = 0;
+    std::size_t n_strips = 1;
+    std::uint64_t strip_rows = 0;
+    std::vector<std::uint64_t> target_hits;
+    std::vector<std::size_t> target_dense;
+};
+
+// Histograms produced next to the main one: the anti-Buddhabrot when
+// config.anti_output is set and one per config.targets entry.
+struct SampleOutputs {
+    std::vector<std::uint64_t> anti;
+    std::vector<std::vector<std::uint64_t>> targets;
+};
+
+// Shared with a running render: the sampler publishes its progress here and
+// stops early once cancelled is set. The sampling streams run as tasks of
+// the given priority on pool, or on the default pool when it is null.
+struct RenderControl {
+    std::atomic<std::uint64_t> progress { 0 };
+    std::atomic<std::uint64_t> total { 0 };
+    std::atomic<bool> cancelled { false };
+    TaskPool* pool = nullptr;
+    int priority = 0;
+};
+
+struct RenderCancelled : std::runtime_error {
+    RenderCancelled()
+        : std::runtime_error("Render cancelled")
+    {
+    }
+};
+
+// 8-bit RGB pixels, row by row from the top, and the file render() writes
+// them to.
+struct Image {
+    std::string output;
+    std::uint64_t width = 0;
+    std::uint64_t height = 0;
+    std::vector<std::uint8_t> rgb;
+
+    std::span<const std::uint8_t> pixels() const
+    {
+        return rgb;
+    }
+};
+
+// Everything a render produces, in memory. With bands or frames counts holds
+// the running sums over the elementary bands (see accumulate_bands). Images
+// are the main image or the frames, then the anti-Buddhabrot, then the
+// targets.
+struct RenderResult {
+    RenderStats stats;
+    std::uint64_t width = 0;
+    std::uint64_t height = 0;
+    std::vector<std::uint64_t> counts;
+    std::vector<Image> images;
+
+    std::span<const std::uint64_t> histogram() const
+    {
+        return counts;
+    }
+};
+
+// Seed points of recent renders keyed by the parameters of their seed mask,
+// so that repeated renders skip the seed pass. Holds at most capacity masks
+// and drops the least recently used one. Safe to share between renders
+// running concurrently; a mask is computed once, outside the lock, even if
+// several renders ask for it at the same time, and the others wait for it.
+// Setting cancelled abandons the computation or the wait with
+// RenderCancelled; the next request for the mask computes it again.
+class SeedCache {
+public:
+    static constexpr std::size_t capacity = 8;
+
+    using Points = std::vector<std::pair<float, float>>;
+
+    std::shared_ptr<const Points> get(const RenderConfig& config, const std::atomic<bool>* cancelled = nullptr);
+
+private:
+    using Key = std::tuple<std::uint64_t, std::uint64_t, std::uint64_t, Formula>;
+
+    struct Entry {
+        std::shared_future<std::shared_ptr<const Points>> points;
+        std::uint64_t last_use;
+        std::uint64_t id;
+    };
+
+    std::mutex mutex;
+    std::map<Key, Entry> entries;
+    std::uint64_t n_uses = 0;
+    std::uint64_t n_entries = 0;
+};
+
+// Output resolution; width and height default to size, which also sets the
+// seed mask resolution.
+std::uint64_t image_width(const RenderConfig& config);
+std::uint64_t image_height(const RenderConfig& config);
+
+// Orbit length windows of the Nebulabrot bands or the frames, whichever are
+// set, or none for a single image.
+std::vector<IterWindow> iter_windows(const RenderConfig& config);
+
+// Rows per out-of-core strip under config.memory_limit, the image height when
+// everything fits.
+std::uint64_t strip_height(const RenderConfig& config);
+
+// Without outputs, anti-Buddhabrot and extra targets are not sampled. With
+// iteration windows the result holds one histogram per elementary band of
+// band_edges(iter_windows(config)), one after the other. Only the given rows
+// are accumulated; a fixed config.seed makes passes over different rows
+// splat the same orbits. A control receives progress and can cancel, which
+// throws RenderCancelled. With pending, good_points is ignored and sampling
+// starts uniformly until pending's points are published. The caller helps run
+// queued pool tasks while it waits, so this may be called from a pool task.
+std::vector<std::uint64_t> sample_buddhabrot(const RenderConfig& config, const std::vector<std::pair<float, float>>& good_points, RenderStats& stats, SampleOutputs* outputs = nullptr, RowRange rows = {}, RenderControl* control = nullptr, PendingSeeds* pending = nullptr);
+
+std::vector<float> log_image(const std::vector<std::uint64_t>& counts);
+
+void write_histogram(const std::string& filename, const std::vector<std::uint64_t>& counts, std::uint64_t width, std::uint64_t height, std::uint64_t max_iter, std::uint64_t n_samples);
+std::vector<std::uint64_t> read_histogram(const std::string& filename, std::uint64_t width, std::uint64_t height, std::uint64_t max_iter, std::uint64_t& n_samples);
+
+// Log scaled counts tone mapped through the colormap.
+std::vector<std::uint8_t> tone_map_image(const std::vector<std::uint64_t>& counts, std::uint64_t width, const std::string& cmap_name);
+// Each channel is log scaled and normalized on its own, then used as the
+// red, green and blue components in that order.
+std::vector<std::uint8_t> nebula_image(const std::vector<std::vector<std::uint64_t>>& channels);
+
+void write_ppm(const Image& image);
+void write_image(const std::string& filename, const std::vector<std::uint64_t>& counts, std::uint64_t width, std::uint64_t height, const std::string& cmap_name);
+// Streams the image from its histogram file strip_rows rows at a time, with
+// the log count range vmin to vmax collected while the strips were written.
+void write_image(const std::string& filename, HistogramFile& histogram, std::uint64_t strip_rows, float vmin, float vmax, const std::string& cmap_name);
+
+// Renders into memory without writing files, taking the seed points from
+// seeds when given. Out-of-core renders (config.memory_limit too small for
+// the image) are not supported here.
+RenderResult render_result(const RenderConfig& config, RenderControl* control = nullptr, SeedCache* seeds = nullptr);
+
+// Renders and writes every image to its output file.
+RenderStats render(const RenderConfig& config);
@@ -0,0 +1,76 @@
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "render.h"
+#include "renderer.h"
+
+Renderer::~Renderer()
+{
+    cancel();
+    wait();
+}
+
+void Renderer::start(const RenderConfig& config)
+{
+    cancel();
+    wait();
+
+    control = std::make_unique<RenderControl>();
+    finished = false;
+    output = {};
+    error = nullptr;
+    worker = std::thread([this, config] {
+        try {
+            output = render_result(config, control.get(), &seeds);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        finished = true;
+    });
+}
+
+double Renderer::progress() const
+{
+    if (control == nullptr) {
+        return 0.0;
+    }
+
+    std::uint64_t total = control->total;
+    return total > 0 ? static_cast<double>(control->progress) / total : 0.0;
+}
+
+bool Renderer::done() const
+{
+    return finished;
+}
+
+void Renderer::cancel()
+{
+    if (control != nullptr) {
+        control->cancelled = true;
+    }
+}
+
+const RenderResult& Renderer::result()
+{
+    if (control == nullptr) {
+        throw std::logic_error("No render was started");
+    }
+
+    wait();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return output;
+}
+
+void Renderer::wait()
+{
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+
+#include "render.h"
+
+// Runs one render at a time on a background thread and hands back its
+// histogram and images in memory, for embedding the renderer in another
+// program. start() returns at once; result() waits for the render. Seed masks
+// stay cached across renders.
+class Renderer {
+public:
+    Renderer() = default;
+    ~Renderer();
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Starts rendering config, cancelling and discarding a render still
+    // running.
+    void start(const RenderConfig& config);
+
+    // Fraction of the samples processed so far, 0 before sampling starts.
+    double progress() const;
+
+    // True once the render has finished, failed or been cancelled.
+    bool done() const;
+
+    void cancel();
+
+    // Waits for the render and returns its result, or rethrows the exception
+    // it failed with (RenderCancelled after cancel()).
+    const RenderResult& result();
+
+private:
+    void wait();
+
+    std::unique_ptr<RenderControl> control;
+    std::atomic<bool> finished { false };
+    std::thread worker;
+    SeedCache seeds;
+    RenderResult output;
+    std::exception_ptr error;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free ring buffer for exactly one producer and one consumer
+// thread. Each side caches the other's index so the shared cache lines are
+// only touched when the ring looks full or empty.
+template <typename Item>
+class SpscRing {
+public:
+    explicit SpscRing(std::size_t capacity)
+        : items(std::bit_ceil(capacity))
+        , mask(items.size() - 1)
+    {
+    }
+
+    bool try_push(const Item& item)
+    {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head_cache == items.size()) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t - head_cache == items.size()) {
+                return false;
+            }
+        }
+
+        items[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(Item& item)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail_cache) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h == tail_cache) {
+                return false;
+            }
+        }
+
+        item = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently with push or pop.
+    std::size_t size() const
+    {
+        std::size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    std::size_t capacity() const
+    {
+        return items.size();
+    }
+
+    // Called by the producer after its last push. A consumer that sees the
+    // ring closed and then fails to pop has drained it.
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<Item> items;
+    std::size_t mask;
+
+    alignas(64) std::atomic<std::size_t> head { 0 };
+    std::size_t tail_cache = 0;
+
+    alignas(64) std::atomic<std::size_t> tail { 0 };
+    std::size_t head_cache = 0;
+
+    alignas(64) std::atomic<bool> closed { false };
+};
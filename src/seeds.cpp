@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "seeds.h"
+
+namespace {
+
+const char seeds_magic[8] = { 'B', 'B', 'S', 'E', 'E', 'D', '2', '\0' };
+
+struct SeedHeader {
+    char magic[8];
+    std::uint64_t formula;
+    std::uint64_t max_iter;
+    std::uint64_t n_samples;
+    std::uint64_t n_seeds;
+};
+
+constexpr double seed_scale = 1073741824.0; // 2^30
+
+}
+
+std::uint32_t quantize_seed(double v)
+{
+    double q = std::round((v + 2.0) * seed_scale);
+    return static_cast<std::uint32_t>(std::clamp(q, 0.0, 4294967295.0));
+}
+
+double dequantize_seed(std::uint32_t q)
+{
+    return q / seed_scale - 2.0;
+}
+
+void write_seeds(const std::string& filename, SeedDatabase& db)
+{
+    std::sort(db.seeds.begin(), db.seeds.end(), [](const EscapeSeed& a, const EscapeSeed& b) {
+        return std::tie(a.n_orbit, a.re, a.im) < std::tie(b.n_orbit, b.re, b.im);
+    });
+
+    SeedHeader header {};
+    std::copy(std::begin(seeds_magic), std::end(seeds_magic), header.magic);
+    header.formula = static_cast<std::uint64_t>(db.formula);
+    header.max_iter = db.max_iter;
+    header.n_samples = db.n_samples;
+    header.n_seeds = db.seeds.size();
+
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(db.seeds.data()), db.seeds.size() * sizeof(EscapeSeed));
+    if (!ofs) {
+        throw std::runtime_error("Failed to write seeds " + filename);
+    }
+}
+
+SeedDatabase read_seeds(const std::string& filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    SeedHeader header {};
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || !std::equal(std::begin(seeds_magic), std::end(seeds_magic), header.magic)) {
+        throw std::runtime_error("Not a seed file: " + filename);
+    }
+    if (header.formula >= n_formulas) {
+        throw std::runtime_error("Unknown formula in seed file " + filename);
+    }
+
+    SeedDatabase db;
+    db.formula = static_cast<Formula>(header.formula);
+    db.max_iter = header.max_iter;
+    db.n_samples = header.n_samples;
+    db.seeds.resize(header.n_seeds);
+    if (!ifs.read(reinterpret_cast<char*>(db.seeds.data()), db.seeds.size() * sizeof(EscapeSeed))) {
+        throw std::runtime_error("Truncated seed file " + filename);
+    }
+
+    return db;
+}
+
+std::pair<const EscapeSeed*, const EscapeSeed*> seed_range(const SeedDatabase& db, std::uint64_t min_orbit, std::uint64_t max_orbit)
+{
+    auto first = std::lower_bound(db.seeds.begin(), db.seeds.end(), min_orbit, [](const EscapeSeed& seed, std::uint64_t n) { return seed.n_orbit < n; });
+    auto last = std::upper_bound(first, db.seeds.end(), max_orbit, [](std::uint64_t n, const EscapeSeed& seed) { return n < seed.n_orbit; });
+
+    return { db.seeds.data() + (first - db.seeds.begin()), db.seeds.data() + (last - db.seeds.begin()) };
+}
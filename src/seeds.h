@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "formula.h"
+
+// An escaping c with its orbit length. Both coordinates are quantized to 32
+// bits over [-2, 2], a step of 2^-30.
+struct EscapeSeed {
+    std::uint32_t re;
+    std::uint32_t im;
+    std::uint32_t n_orbit;
+};
+
+struct SeedDatabase {
+    Formula formula = Formula::mandelbrot;
+    std::uint64_t max_iter = 0;
+    std::uint64_t n_samples = 0;
+    std::vector<EscapeSeed> seeds;
+};
+
+std::uint32_t quantize_seed(double v);
+double dequantize_seed(std::uint32_t q);
+
+// Sorts by orbit length (then position, for reproducible files) and writes
+// the database.
+void write_seeds(const std::string& filename, SeedDatabase& db);
+SeedDatabase read_seeds(const std::string& filename);
+
+// Seeds with min_orbit <= n_orbit <= max_orbit, found by binary search in the
+// sorted seed list.
+std::pair<const EscapeSeed*, const EscapeSeed*> seed_range(const SeedDatabase& db, std::uint64_t min_orbit, std::uint64_t max_orbit);
@@ -0,0 +1,158 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+namespace {
+
+// Closes the descriptor on scope exit.
+struct FileDescriptor {
+    int fd;
+
+    explicit FileDescriptor(int fd)
+        : fd(fd)
+    {
+    }
+
+    ~FileDescriptor()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+};
+
+// A client that hung up fails the send instead of raising SIGPIPE, which
+// would kill the server.
+bool write_all(int fd, const std::string& data)
+{
+    std::size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
+    }
+
+    return true;
+}
+
+// Serves the lines of one connection; returns true when a request asked the
+// server to stop.
+bool serve_connection(int fd, const RequestHandler& handle)
+{
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        std::size_t newline;
+        while ((newline = buffer.find('\n')) != std::string::npos) {
+            std::string request = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+
+            bool stop = false;
+            if (!write_all(fd, handle(request, stop) + "\n") || stop) {
+                return stop;
+            }
+        }
+
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+}
+
+// Removes a socket file left behind by a server that is gone. Anything else
+// at path, or a socket a server still accepts on, is an error.
+void remove_stale_socket(const std::string& path, const sockaddr_un& addr)
+{
+    struct stat st {};
+    if (lstat(path.c_str(), &st) != 0) {
+        if (errno == ENOENT) {
+            return;
+        }
+        throw std::runtime_error("Failed to check " + path + ": " + std::strerror(errno));
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        throw std::invalid_argument(path + " exists and is not a socket");
+    }
+
+    FileDescriptor probe(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (probe.fd >= 0 && connect(probe.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0) {
+        throw std::runtime_error("A server is already listening on " + path);
+    }
+    unlink(path.c_str());
+}
+
+}
+
+void serve_stream(std::istream& in, std::ostream& out, const RequestHandler& handle)
+{
+    std::string request;
+    while (std::getline(in, request)) {
+        bool stop = false;
+        out << handle(request, stop) << std::endl;
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void serve_socket(const std::string& path, const RequestHandler& handle)
+{
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("Socket path too long: " + path);
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+
+    remove_stale_socket(path, addr);
+    FileDescriptor server(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (server.fd < 0 || bind(server.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server.fd, 8) != 0) {
+        throw std::runtime_error("Failed to listen on " + path + ": " + std::strerror(errno));
+    }
+
+    bool stop = false;
+    while (!stop) {
+        FileDescriptor connection(accept(server.fd, nullptr, nullptr));
+        if (connection.fd < 0) {
+            // Out of descriptors or memory may pass once running requests
+            // finish elsewhere, so wait a little; other errors won't.
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            int error = errno;
+            unlink(path.c_str());
+            throw std::runtime_error("Failed to accept on " + path + ": " + std::strerror(error));
+        }
+        stop = serve_connection(connection.fd, handle);
+    }
+    unlink(path.c_str());
+}
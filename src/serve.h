@@ -0,0 +1,16 @@
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+// Answers one request line with one response line, setting stop to shut the
+// server down after the response is sent.
+using RequestHandler = std::function<std::string(const std::string& request, bool& stop)>;
+
+// Serves requests read line by line from in until end of input.
+void serve_stream(std::istream& in, std::ostream& out, const RequestHandler& handle);
+
+// Listens on a Unix domain socket at path and serves the lines of one
+// connection after the other.
+void serve_socket(const std::string& path, const RequestHandler& handle);
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "strips.h"
+
+std::uint64_t strip_height(std::uint64_t width, std::uint64_t height, std::uint64_t n_histograms, std::uint64_t memory_limit)
+{
+    if (memory_limit == 0) {
+        return height;
+    }
+
+    std::uint64_t row_bytes = width * n_histograms * sizeof(std::uint64_t);
+    if (row_bytes > memory_limit) {
+        throw std::invalid_argument("Memory limit is too small for a single row of " + std::to_string(n_histograms) + " histograms");
+    }
+
+    return std::min(height, memory_limit / row_bytes);
+}
+
+HistogramFile::HistogramFile(const std::string& filename, std::uint64_t width, std::uint64_t height)
+    : filename(filename)
+    , file(filename, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc)
+    , n_cols(width)
+    , n_rows(height)
+{
+    if (!file) {
+        throw std::runtime_error("Failed to create histogram file " + filename);
+    }
+}
+
+HistogramFile::~HistogramFile()
+{
+    file.close();
+    std::error_code ec;
+    std::filesystem::remove(filename, ec);
+}
+
+void HistogramFile::append(const std::vector<std::uint64_t>& rows)
+{
+    if (rows.size() % n_cols != 0 || n_written + rows.size() / n_cols > n_rows) {
+        throw std::invalid_argument("Strip doesn't fit histogram file " + filename);
+    }
+
+    file.seekp(n_written * n_cols * sizeof(std::uint64_t));
+    file.write(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(std::uint64_t));
+    if (!file) {
+        throw std::runtime_error("Failed to write histogram file " + filename);
+    }
+    n_written += rows.size() / n_cols;
+}
+
+std::vector<std::uint64_t> HistogramFile::read(std::uint64_t first_row, std::uint64_t n)
+{
+    if (first_row + n > n_written) {
+        throw std::invalid_argument("Rows not yet written to histogram file " + filename);
+    }
+
+    std::vector<std::uint64_t> rows(n * n_cols);
+    file.seekg(first_row * n_cols * sizeof(std::uint64_t));
+    if (!file.read(reinterpret_cast<char*>(rows.data()), rows.size() * sizeof(std::uint64_t))) {
+        throw std::runtime_error("Failed to read histogram file " + filename);
+    }
+
+    return rows;
+}
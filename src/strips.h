@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Rows per horizontal strip so that n_histograms strip histograms of width
+// pixels fit in memory_limit bytes, or height when the whole image fits or
+// there is no limit.
+std::uint64_t strip_height(std::uint64_t width, std::uint64_t height, std::uint64_t n_histograms, std::uint64_t memory_limit);
+
+// Histogram of width x height counts kept in a file rather than in memory,
+// appended one strip of rows after the other in row order and read back the
+// same way. The file is removed again on destruction.
+class HistogramFile {
+public:
+    HistogramFile(const std::string& filename, std::uint64_t width, std::uint64_t height);
+    ~HistogramFile();
+
+    HistogramFile(const HistogramFile&) = delete;
+    HistogramFile& operator=(const HistogramFile&) = delete;
+
+    void append(const std::vector<std::uint64_t>& rows);
+    std::vector<std::uint64_t> read(std::uint64_t first_row, std::uint64_t n_rows);
+
+    std::uint64_t width() const
+    {
+        return n_cols;
+    }
+
+    std::uint64_t height() const
+    {
+        return n_rows;
+    }
+
+private:
+    std::string filename;
+    std::fstream file;
+    std::uint64_t n_cols;
+    std::uint64_t n_rows;
+    std::uint64_t n_written = 0;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "kernels.h"
+
+// An extra viewport and resolution that every orbit point is splatted into
+// next to the main histogram. Counts start out in a hash map, which keeps
+// close-ups that few orbits reach cheap, and switch to a dense histogram once
+// more than 1 / densify_divisor of the pixels have been hit.
+template <typename T>
+struct SplatTarget {
+    kernels::PixelMap<T> view;
+    std::vector<std::uint64_t> dense {};
+    std::unordered_map<std::uint64_t, std::uint64_t> sparse {};
+    std::uint64_t n_hits = 0;
+
+    static constexpr std::uint64_t densify_divisor = 8;
+
+    bool is_dense() const
+    {
+        return !dense.empty();
+    }
+
+    void add(const std::uint64_t* indices, std::size_t n)
+    {
+        n_hits += n;
+        if (is_dense()) {
+            for (std::size_t i = 0; i < n; ++i) {
+                dense[indices[i]]++;
+            }
+            return;
+        }
+
+        for (std::size_t i = 0; i < n; ++i) {
+            sparse[indices[i]]++;
+        }
+        if (sparse.size() > view.width * view.height / densify_divisor) {
+            densify();
+        }
+    }
+
+    void densify()
+    {
+        dense.assign(view.width * view.height, 0);
+        for (auto [index, count] : sparse) {
+            dense[index] += count;
+        }
+        sparse = {};
+    }
+
+    void add_to(std::vector<std::uint64_t>& result) const
+    {
+        if (is_dense()) {
+            std::transform(result.begin(), result.end(), dense.begin(), result.begin(), [](std::uint64_t cur, std::uint64_t res) { return cur + res; });
+        } else {
+            for (auto [index, count] : sparse) {
+                result[index] += count;
+            }
+        }
+    }
+};
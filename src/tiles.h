@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Pixel counts stored in tiles of tile_size consecutive pixels, each
+// allocated zeroed on its first write from an arena of blocks that the
+// histogram owns. Memory grows with the pixels an orbit set actually reaches
+// rather than with the image area, and untouched tiles cost one null pointer.
+class TiledHistogram {
+public:
+    static constexpr unsigned tile_log2 = 12;
+    static constexpr std::uint64_t tile_size = std::uint64_t { 1 } << tile_log2;
+    static constexpr std::size_t max_block_tiles = 64;
+
+    TiledHistogram() = default;
+
+    explicit TiledHistogram(std::uint64_t n_pixels)
+        : n_pixels(n_pixels)
+        , tiles((n_pixels + tile_size - 1) >> tile_log2, nullptr)
+    {
+    }
+
+    // Copies are compacted into a fresh arena.
+    TiledHistogram(const TiledHistogram& other)
+        : n_pixels(other.n_pixels)
+        , tiles(other.tiles.size(), nullptr)
+    {
+        for (std::size_t t = 0; t < tiles.size(); ++t) {
+            if (other.tiles[t] != nullptr) {
+                tiles[t] = allocate_tile();
+                std::copy(other.tiles[t], other.tiles[t] + tile_size, tiles[t]);
+            }
+        }
+    }
+
+    TiledHistogram& operator=(const TiledHistogram& other)
+    {
+        if (this != &other) {
+            TiledHistogram copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    TiledHistogram(TiledHistogram&&) = default;
+    TiledHistogram& operator=(TiledHistogram&&) = default;
+
+    void add(std::uint64_t pixel)
+    {
+        std::uint64_t*& tile = tiles[pixel >> tile_log2];
+        if (tile == nullptr) [[unlikely]] {
+            tile = allocate_tile();
+        }
+        tile[pixel & (tile_size - 1)]++;
+    }
+
+    std::uint64_t size() const
+    {
+        return n_pixels;
+    }
+
+    bool empty() const
+    {
+        return n_pixels == 0;
+    }
+
+    std::size_t n_tiles() const
+    {
+        return tiles.size();
+    }
+
+    std::size_t n_touched() const
+    {
+        return n_allocated;
+    }
+
+    // Adds the touched tiles to the dense histogram result.
+    void add_to(std::vector<std::uint64_t>& result) const
+    {
+        add_to(result, 0, tiles.size());
+    }
+
+    // Adds the touched tiles among [first_tile, last_tile) only, so disjoint
+    // tile ranges can be merged concurrently.
+    void add_to(std::vector<std::uint64_t>& result, std::size_t first_tile, std::size_t last_tile) const
+    {
+        for (std::size_t t = first_tile; t < last_tile; ++t) {
+            if (tiles[t] == nullptr) {
+                continue;
+            }
+            std::uint64_t first = t << tile_log2;
+            std::uint64_t n = std::min(tile_size, n_pixels - first);
+            std::transform(tiles[t], tiles[t] + n, result.begin() + first, result.begin() + first, [](std::uint64_t cur, std::uint64_t res) { return cur + res; });
+        }
+    }
+
+private:
+    // Blocks double in size up to max_block_tiles tiles, so short jobs only
+    // reserve what they touch and long ones allocate rarely.
+    std::uint64_t* allocate_tile()
+    {
+        if (block_used == block_tiles) {
+            block_tiles = blocks.empty() ? 1 : std::min(2 * block_tiles, max_block_tiles);
+            blocks.push_back(std::make_unique<std::uint64_t[]>(block_tiles * tile_size));
+            block_used = 0;
+        }
+        ++n_allocated;
+        return blocks.back().get() + tile_size * block_used++;
+    }
+
+    std::uint64_t n_pixels = 0;
+    std::vector<std::uint64_t*> tiles;
+    std::vector<std::unique_ptr<std::uint64_t[]>> blocks;
+    std::size_t block_tiles = 0;
+    std::size_t block_used = 0;
+    std::size_t n_allocated = 0;
+};